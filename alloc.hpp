@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdlib>
+#include <cstddef>
+#include <new>
+#include <sys/mman.h>
+
+//
+// allocators for the data vector: aligned_allocator<T, A> aligns it to
+// A bytes (a cache line by default), so that chunk boundaries rounded to
+// cache lines are really on a line boundary; huge_page_allocator<T>
+// aligns it to 2 MB and asks the kernel for transparent huge pages
+//
+
+const size_t CACHE_LINE = 64;
+const size_t HUGE_PAGE = 2 << 20;
+
+template <typename T, size_t A = CACHE_LINE>
+struct aligned_allocator
+{
+  typedef T value_type;
+  template <typename U> struct rebind { typedef aligned_allocator<U, A> other; };
+
+  aligned_allocator() {}
+  template <typename U> aligned_allocator(const aligned_allocator<U, A>&) {}
+
+  // aligned_alloc wants a size multiple of the alignment
+  static size_t round(size_t n) { return (n * sizeof(T) + A - 1) / A * A; }
+
+  T* allocate(size_t n) {
+    void* p = std::aligned_alloc(A, round(n));
+    if (p == NULL) throw std::bad_alloc();
+    return (T*) p;
+  }
+
+  void deallocate(T* p, size_t) { std::free(p); }
+};
+
+template <typename T>
+struct huge_page_allocator : aligned_allocator<T, HUGE_PAGE>
+{
+  template <typename U> struct rebind { typedef huge_page_allocator<U> other; };
+
+  huge_page_allocator() {}
+  template <typename U> huge_page_allocator(const huge_page_allocator<U>&) {}
+
+  T* allocate(size_t n) {
+    T* p = aligned_allocator<T, HUGE_PAGE>::allocate(n);
+    // only a hint: if THP are disabled we simply get normal pages
+    madvise(p, aligned_allocator<T, HUGE_PAGE>::round(n), MADV_HUGEPAGE);
+    return p;
+  }
+};
+
+template <typename T, typename U, size_t A>
+bool operator==(const aligned_allocator<T, A>&, const aligned_allocator<U, A>&) { return true; }
+template <typename T, typename U, size_t A>
+bool operator!=(const aligned_allocator<T, A>&, const aligned_allocator<U, A>&) { return false; }
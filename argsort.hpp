@@ -0,0 +1,235 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <thread>
+#include <memory>
+#include <cstring>
+#include <algorithm>
+#include <type_traits>
+#include "cmpcost.hpp"
+
+//
+// records and indirect sorting. With --records=<bytes> the engines sort
+// records of 64, 128 or 256 bytes instead of bare keys, so that every
+// transposition moves a whole record. With --argsort they sort instead
+// a compact array of (key, index) pairs, whose swaps cost the same
+// whatever the record size, and then move every record once by applying
+// the permutation:
+//   gather  in parallel into a second array (sequential writes)
+//   cycle   in place, following the cycles of the permutation in parallel
+//   none    the records are left alone, the permutation is the result
+//
+
+enum permute_mode { PERMUTE_GATHER, PERMUTE_CYCLE, PERMUTE_NONE };
+
+struct record_config {
+  int bytes = 0;  // 0 sorts bare keys
+  bool argsort = false;
+  permute_mode mode = PERMUTE_GATHER;
+};
+
+inline record_config& record_cfg() {
+  static record_config cfg;
+  return cfg;
+}
+
+inline int key_int(int k) { return k; }
+inline int key_int(const costly_int& k) { return k.v; }
+
+// the payload repeats the key, so that a record torn apart is detected
+template<typename K, int BYTES>
+struct record {
+  static_assert(BYTES >= (int) (sizeof(K) + sizeof(int)), "record too small");
+  K key;
+  char payload[BYTES - sizeof(K)];
+  record(int k = 0) : key(k) {
+    for (size_t i = 0; i + sizeof(int) <= sizeof(payload); i += sizeof(int))
+      std::memcpy(payload + i, &k, sizeof(int));
+  }
+  bool operator<(const record& o) const { return key < o.key; }
+  bool operator<=(const record& o) const { return !(o < *this); }
+  bool intact() const {
+    int k;
+    std::memcpy(&k, payload + sizeof(payload) / sizeof(int) / 2 * sizeof(int), sizeof(int));
+    return k == key_int(key);
+  }
+};
+
+template<typename T> struct is_record : std::false_type {};
+template<typename K, int BYTES> struct is_record<record<K, BYTES>> : std::true_type {};
+
+template<typename T>
+bool intact(const T& x) {
+  if constexpr (is_record<T>::value)
+    return x.intact();
+  else
+    return true;
+}
+
+// what the engines sort in argsort mode; ties keep the original order,
+// since odd-even transposition sort is stable
+template<typename K>
+struct key_index {
+  K key;
+  int idx;
+  key_index(int k = 0) : key(k), idx(0) {}
+  key_index(const K& k, int i) : key(k), idx(i) {}
+  bool operator<(const key_index& o) const { return key < o.key; }
+  bool operator<=(const key_index& o) const { return !(o < *this); }
+};
+
+// the (key, index) array of recs, allocated as recs is
+template<typename V>
+using key_vector = std::vector<
+  key_index<decltype(std::declval<typename V::value_type>().key)>,
+  typename std::allocator_traits<typename V::allocator_type>::template rebind_alloc<
+    key_index<decltype(std::declval<typename V::value_type>().key)>>>;
+
+template<typename F>
+void argsort_parallel(int nw, size_t n, F f) {
+  std::vector<std::thread> tids;
+  for (int t = 0; t < nw; ++t)
+    tids.emplace_back(f, n * t / nw, n * (t + 1) / nw);
+  for (auto& t : tids)
+    t.join();
+}
+
+template<typename V, typename KV>
+void make_keys(const V& recs, KV& keys, int nw) {
+  argsort_parallel(nw, recs.size(), [&](size_t lo, size_t hi) {
+    for (size_t i = lo; i < hi; ++i)
+      keys[i] = {recs[i].key, (int) i};
+  });
+}
+
+// recs[i] = old recs[keys[i].idx]: reads are random, so they are
+// prefetched a few records ahead, writes are sequential
+template<typename V, typename KV>
+void permute_gather(V& recs, const KV& keys, int nw) {
+  const size_t ahead = 8;
+  V out(recs.size());
+  argsort_parallel(nw, recs.size(), [&](size_t lo, size_t hi) {
+    for (size_t i = lo; i < hi; ++i) {
+      if (i + ahead < hi)
+        __builtin_prefetch(&recs[keys[i + ahead].idx]);
+      out[i] = recs[keys[i].idx];
+    }
+  });
+  recs.swap(out);
+}
+
+// the same permutation in place: the cycles are disjoint, and each is
+// moved by the thread owning its smallest index. The leaders are marked
+// beforehand by a single walk over every cycle, which reads the keys
+// alone and takes n steps: a walk of each thread on its own, stopping
+// at the first smaller index, is quadratic on cycles such as a zig-zag
+template<typename V, typename KV>
+void permute_cycle(V& recs, const KV& keys, int nw) {
+  const size_t n = recs.size();
+  std::vector<bool> seen(n), leader(n);
+  for (size_t i = 0; i < n; ++i) {
+    if (seen[i])
+      continue;
+    leader[i] = keys[i].idx != (int) i;  // fixed points stay
+    for (size_t j = i; !seen[j]; j = keys[j].idx)
+      seen[j] = true;
+  }
+  argsort_parallel(nw, n, [&](size_t lo, size_t hi) {
+    for (size_t i = lo; i < hi; ++i) {
+      if (!leader[i])
+        continue;
+      auto tmp = recs[i];
+      size_t j;
+      for (j = i; (size_t) keys[j].idx != i; j = keys[j].idx)
+        recs[j] = recs[keys[j].idx];
+      recs[j] = tmp;
+    }
+  });
+}
+
+// sort recs by key with sort(keys), then apply the permutation as
+// configured; with PERMUTE_NONE it is stored in perm instead
+template<typename V, typename S>
+auto argsort(V& recs, int nw, std::vector<int>& perm, S sort) {
+  key_vector<V> keys(recs.size());
+  make_keys(recs, keys, nw);
+  auto res = sort(keys);
+  switch (record_cfg().mode) {
+  case PERMUTE_GATHER:
+    permute_gather(recs, keys, nw);
+    break;
+  case PERMUTE_CYCLE:
+    permute_cycle(recs, keys, nw);
+    break;
+  case PERMUTE_NONE:
+    perm.resize(keys.size());
+    for (size_t i = 0; i < keys.size(); ++i)
+      perm[i] = keys[i].idx;
+    break;
+  }
+  return res;
+}
+
+// v is sorted with its records intact or, if perm is not empty, v is
+// sorted when read through perm, which must be a permutation
+template<typename V>
+bool check_sorted(const V& v, const std::vector<int>& perm) {
+  if (perm.empty())
+    return std::is_sorted(v.begin(), v.end()) &&
+      std::all_of(v.begin(), v.end(), [](const auto& x) { return intact(x); });
+  std::vector<bool> seen(v.size());
+  for (size_t i = 0; i < perm.size(); ++i) {
+    if (perm[i] < 0 || (size_t) perm[i] >= v.size() || seen[perm[i]])
+      return false;
+    seen[perm[i]] = true;
+    if (i > 0 && v[perm[i]] < v[perm[i - 1]])
+      return false;
+  }
+  return true;
+}
+
+// strip --records=<bytes> and --argsort[=gather|cycle|none] from the
+// command line; returns false on a malformed option
+inline bool record_args(int& argc, char* argv[]) {
+  record_config& cfg = record_cfg();
+  int k = 1;
+  for (int i = 1; i < argc; ++i) {
+    std::string a = argv[i];
+    if (a.rfind("--records=", 0) == 0) {
+      cfg.bytes = std::stoi(a.substr(10));
+      if (cfg.bytes != 64 && cfg.bytes != 128 && cfg.bytes != 256) {
+        std::cerr << "records must be 64, 128 or 256 bytes long\n";
+        return false;
+      }
+    }
+    else if (a == "--argsort" || a == "--argsort=gather")
+      cfg.argsort = true, cfg.mode = PERMUTE_GATHER;
+    else if (a == "--argsort=cycle")
+      cfg.argsort = true, cfg.mode = PERMUTE_CYCLE;
+    else if (a == "--argsort=none")
+      cfg.argsort = true, cfg.mode = PERMUTE_NONE;
+    else if (a.rfind("--argsort", 0) == 0) {
+      std::cerr << "unknown option " << a << '\n';
+      return false;
+    }
+    else
+      argv[k++] = argv[i];
+  }
+  argc = k;
+  if (cfg.argsort && cfg.bytes == 0) {
+    std::cerr << "--argsort needs --records\n";
+    return false;
+  }
+  return true;
+}
+
+// to be appended to the log message of an experiment
+inline std::string record_describe() {
+  const record_config& cfg = record_cfg();
+  if (cfg.bytes == 0) return "";
+  static const char* modes[] = {"gather", "cycle", "none"};
+  return " --records=" + std::to_string(cfg.bytes) +
+    (cfg.argsort ? std::string(" --argsort=") + modes[cfg.mode] : "");
+}
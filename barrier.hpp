@@ -0,0 +1,93 @@
+#pragma once
+
+#include <atomic>
+#include "wait.hpp"
+
+//
+// a reusable barrier for a fixed set of threads
+// (sense reversing: the generation counter tells apart
+// consecutive episodes, so no thread can overtake the others).
+// The last thread to arrive resets the count before it starts the
+// next generation, and the others wait for it with the policy given
+// to the constructor (wait.hpp)
+//
+
+class barrier
+{
+private:
+  const int                  d_nthreads;
+  std::atomic<int>           d_count;
+  std::atomic<unsigned long> d_generation{0};
+  wait_point                 d_waiter;
+public:
+
+  barrier(int nthreads, wait_policy policy = WAIT_BLOCK)
+    : d_nthreads(nthreads), d_count(nthreads), d_waiter(policy) {}
+
+  void wait() {
+    unsigned long gen = this->d_generation.load(std::memory_order_acquire);
+    if (this->d_count.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      this->d_count.store(this->d_nthreads, std::memory_order_relaxed);
+      this->d_generation.fetch_add(1, std::memory_order_acq_rel);
+      this->d_waiter.notify();
+      return;
+    }
+    this->d_waiter.wait([&]{ return gen != this->d_generation.load(std::memory_order_acquire); });
+  }
+};
+
+//
+// the barrier of oesort_pthreads_sync in pthread-barrier.cpp, which
+// goes through a main thread: the main thread starts a round with
+// start() and waits with finish() for the nworkers to end it, the
+// workers wait for the next round with next() and report with end().
+// Between two rounds every worker is parked and the main thread is
+// alone, which is where that engine checks for termination and takes
+// checkpoints
+//
+
+class handoff
+{
+private:
+  const int         d_nworkers;
+  std::atomic<int>  d_round{0};        // rounds started
+  std::atomic<int>  d_count{0};        // workers that ended the round
+  std::atomic<bool> d_shutdown{false};
+  wait_point        d_go;
+  wait_point        d_done;
+public:
+
+  handoff(int nworkers, wait_policy policy = WAIT_BLOCK)
+    : d_nworkers(nworkers), d_go(policy), d_done(policy) {}
+
+  // main thread
+  void start() {
+    ++this->d_round;
+    this->d_go.notify();
+  }
+
+  void finish() {
+    this->d_done.wait([&]{ return this->d_count == this->d_nworkers; });
+    this->d_count = 0;
+  }
+
+  void stop() {
+    this->d_shutdown = true;
+    this->d_go.notify();
+  }
+
+  // workers: seen is the number of rounds the worker has run, false
+  // once the main thread stopped
+  bool next(int& seen) {
+    this->d_go.wait([&]{ return this->d_round.load() > seen || this->d_shutdown; });
+    if (this->d_shutdown)
+      return false;
+    ++seen;
+    return true;
+  }
+
+  void end() {
+    if (++this->d_count == this->d_nworkers)
+      this->d_done.notify();
+  }
+};
@@ -0,0 +1,174 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <cstdlib>
+#include <cstdio>
+#include <chrono>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+//
+// checkpoints of a sort to a memory-mapped file. The file holds two
+// slots, each with the engine's counters and a copy of the vector, and
+// a header telling which slot holds the last complete checkpoint: a
+// checkpoint is written into the other slot and flushed, and only then
+// the header is switched, so that a job killed while checkpointing
+// resumes from the previous one. Engines take checkpoints at cut points
+// where the vector and the counters are consistent, at most once every
+// --checkpoint-every seconds, and --resume restarts from the last one.
+//
+
+struct checkpoint_config {
+  std::string path;    // empty disables checkpoints
+  double every = 10;   // seconds between checkpoints
+  bool resume = false;
+};
+
+inline checkpoint_config& checkpoint_cfg() {
+  static checkpoint_config cfg;
+  return cfg;
+}
+
+struct ckpt_header {
+  char magic[8];
+  uint64_t tag;        // hash of the job description
+  int64_t n;
+  int64_t elem_size;
+  int64_t nmeta;
+  int64_t committed;   // checkpoints completed, the last is in slot (committed - 1) & 1
+};
+
+class checkpoint {
+  static constexpr const char* MAGIC = "OESCKPT";
+  int fd = -1;
+  char* base = nullptr;
+  size_t slot_bytes = 0, file_bytes = 0;
+  ckpt_header* hdr = nullptr;
+  const int64_t nmeta;
+  const size_t data_bytes;
+  bool was_resumed = false;
+  long count = 0;
+  double spent = 0;
+  std::chrono::steady_clock::time_point last = std::chrono::steady_clock::now();
+
+  static void die(const std::string& what) {
+    perror(what.c_str());
+    exit(-1);
+  }
+
+  // FNV-1a
+  static uint64_t hash(const std::string& s) {
+    uint64_t h = 1469598103934665603ULL;
+    for (unsigned char c : s)
+      h = (h ^ c) * 1099511628211ULL;
+    return h;
+  }
+
+  char* slot(int64_t i) const { return base + 4096 + (i & 1) * slot_bytes; }
+
+public:
+  // job describes what must not change across a resume (the engine and
+  // its parameters); nmeta counters are saved along with n elements
+  checkpoint(const std::string& job, int64_t n, size_t elem_size, int64_t nmeta)
+    : nmeta(nmeta), data_bytes(n * elem_size) {
+    const checkpoint_config& cfg = checkpoint_cfg();
+    slot_bytes = (nmeta * sizeof(int64_t) + data_bytes + 4095) / 4096 * 4096;
+    file_bytes = 4096 + 2 * slot_bytes;
+    fd = open(cfg.path.c_str(), cfg.resume ? O_RDWR : O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) die(cfg.path);
+    if (!cfg.resume && ftruncate(fd, file_bytes) < 0) die("ftruncate");
+    if (cfg.resume && lseek(fd, 0, SEEK_END) != (off_t) file_bytes) {
+      std::cerr << cfg.path << " does not hold a checkpoint of this job\n";
+      exit(-1);
+    }
+    base = (char*) mmap(NULL, file_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) die("mmap");
+    hdr = (ckpt_header*) base;
+    if (cfg.resume) {
+      if (std::memcmp(hdr->magic, MAGIC, 8) || hdr->tag != hash(job) || hdr->n != n ||
+          hdr->elem_size != (int64_t) elem_size || hdr->nmeta != nmeta) {
+        std::cerr << cfg.path << " does not hold a checkpoint of this job\n";
+        exit(-1);
+      }
+      was_resumed = hdr->committed > 0;
+    }
+    else {
+      std::memcpy(hdr->magic, MAGIC, 8);
+      hdr->tag = hash(job);
+      hdr->n = n;
+      hdr->elem_size = elem_size;
+      hdr->nmeta = nmeta;
+      hdr->committed = 0;
+    }
+  }
+
+  ~checkpoint() {
+    munmap(base, file_bytes);
+    close(fd);
+  }
+
+  // whether the last checkpoint has been loaded, then meta() and data()
+  // are the counters and the vector saved by it
+  bool resumed() const { return was_resumed; }
+  const int64_t* meta() const { return (const int64_t*) slot(hdr->committed - 1); }
+  const void* data() const { return slot(hdr->committed - 1) + nmeta * sizeof(int64_t); }
+
+  // whether it is time for a checkpoint
+  bool due() const {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - last).count() >=
+      checkpoint_cfg().every;
+  }
+
+  // write(meta, data) fills the free slot, which becomes the last one
+  template<typename F>
+  void save(F write) {
+    auto start = std::chrono::steady_clock::now();
+    char* s = slot(hdr->committed);
+    write((int64_t*) s, (void*) (s + nmeta * sizeof(int64_t)));
+    if (msync(s, slot_bytes, MS_SYNC) < 0) die("msync");
+    __atomic_store_n(&hdr->committed, hdr->committed + 1, __ATOMIC_RELEASE);
+    if (msync(base, 4096, MS_SYNC) < 0) die("msync");
+    last = std::chrono::steady_clock::now();
+    spent += std::chrono::duration<double>(last - start).count();
+    ++count;
+  }
+
+  // the sort is over: the file is not needed anymore
+  void finish(double run_seconds) {
+    std::cerr << "checkpoints: " << count << " taken, " << (long) (spent * 1e6) << " usec ("
+              << 100 * spent / std::max(run_seconds, 1e-9) << "% of the run), "
+              << (nmeta * sizeof(int64_t) + data_bytes) / 1024 << " KiB each\n";
+    unlink(checkpoint_cfg().path.c_str());
+  }
+};
+
+// strip --checkpoint=<file>, --checkpoint-every=<seconds> and --resume
+// from the command line; returns false on a malformed option
+inline bool checkpoint_args(int& argc, char* argv[]) {
+  checkpoint_config& cfg = checkpoint_cfg();
+  int k = 1;
+  for (int i = 1; i < argc; ++i) {
+    std::string a = argv[i];
+    if (a.rfind("--checkpoint=", 0) == 0)
+      cfg.path = a.substr(13);
+    else if (a.rfind("--checkpoint-every=", 0) == 0)
+      cfg.every = std::stod(a.substr(19));
+    else if (a == "--resume")
+      cfg.resume = true;
+    else
+      argv[k++] = argv[i];
+  }
+  argc = k;
+  if (cfg.resume && cfg.path.empty()) {
+    std::cerr << "--resume needs --checkpoint\n";
+    return false;
+  }
+  return true;
+}
+
+inline bool checkpoint_enabled() { return !checkpoint_cfg().path.empty(); }
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <algorithm>
+#include <numeric>
+
+//
+// synthetic comparison cost: costly_int behaves as an int, but its
+// operator< burns a calibrated amount of work first, so that engines can
+// be evaluated under expensive comparators without porting them here.
+// It is enabled by --cmp-cost=<ns>, and --cmp-class=<class> selects the
+// kind of work: compute (a dependent chain of arithmetic) or memory
+// (pointer chasing over a buffer much larger than the caches).
+//
+
+enum cmp_class { CMP_COMPUTE, CMP_MEMORY };
+
+struct cmp_cost_config {
+  long ns = 0;                   // requested cost of a comparison, 0 disables it
+  cmp_class cls = CMP_COMPUTE;
+  long steps = 0;                // calibrated steps per comparison
+  std::vector<uint32_t> chase;   // a single random cycle, for CMP_MEMORY
+};
+
+inline cmp_cost_config& cmp_cost() {
+  static cmp_cost_config cfg;
+  return cfg;
+}
+
+// one step of work starting from x, returns where the next step starts
+inline uint32_t cmp_step(uint32_t x) {
+  const cmp_cost_config& cfg = cmp_cost();
+  if (cfg.cls == CMP_MEMORY)
+    return cfg.chase[x & (cfg.chase.size() - 1)];
+  // xorshift, each step depends on the previous one
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return x;
+}
+
+inline uint32_t cmp_burn(uint32_t x, long steps) {
+  for (long i = 0; i < steps; ++i)
+    x = cmp_step(x);
+  return x;
+}
+
+// a sink the compiler cannot optimize the work away from
+inline thread_local uint32_t cmp_sink;
+
+struct costly_int {
+  int v;
+  costly_int(int x = 0) : v(x) {}
+  bool operator<(const costly_int& o) const {
+    cmp_sink += cmp_burn(v ^ o.v ^ cmp_sink, cmp_cost().steps);
+    return v < o.v;
+  }
+  bool operator<=(const costly_int& o) const { return !(o < *this); }
+};
+
+inline void cmp_cost_calibrate() {
+  cmp_cost_config& cfg = cmp_cost();
+  if (cfg.cls == CMP_MEMORY) {
+    // Sattolo's algorithm: a random permutation made of a single cycle
+    // over 64 MB, so that (almost) every step misses every cache
+    cfg.chase.resize(16 << 20);
+    std::iota(cfg.chase.begin(), cfg.chase.end(), 0);
+    for (size_t i = cfg.chase.size() - 1; i > 0; --i)
+      std::swap(cfg.chase[i], cfg.chase[rand() % i]);
+  }
+  const long probe = (cfg.cls == CMP_MEMORY) ? 1 << 20 : 1 << 26;
+  auto start = std::chrono::steady_clock::now();
+  cmp_sink += cmp_burn(1, probe);
+  double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  cfg.steps = std::max(1L, (long) (cfg.ns * probe / ns));
+}
+
+// strip --cmp-cost=<ns> and --cmp-class=<class> from the command line,
+// so that engines keep parsing their positional arguments unchanged;
+// returns false on a malformed option
+inline bool cmp_cost_args(int& argc, char* argv[]) {
+  cmp_cost_config& cfg = cmp_cost();
+  int k = 1;
+  for (int i = 1; i < argc; ++i) {
+    std::string a = argv[i];
+    if (a.rfind("--cmp-cost=", 0) == 0)
+      cfg.ns = std::stol(a.substr(11));
+    else if (a == "--cmp-class=compute")
+      cfg.cls = CMP_COMPUTE;
+    else if (a == "--cmp-class=memory")
+      cfg.cls = CMP_MEMORY;
+    else if (a.rfind("--cmp-", 0) == 0) {
+      std::cerr << "unknown option " << a << '\n';
+      return false;
+    }
+    else
+      argv[k++] = argv[i];
+  }
+  argc = k;
+  if (cfg.ns > 0)
+    cmp_cost_calibrate();
+  return true;
+}
+
+inline bool cmp_cost_enabled() { return cmp_cost().ns > 0; }
+
+// to be appended to the log message of an experiment
+inline std::string cmp_cost_describe() {
+  const cmp_cost_config& cfg = cmp_cost();
+  if (!cmp_cost_enabled()) return "";
+  return std::string(" --cmp-cost=") + std::to_string(cfg.ns) +
+    (cfg.cls == CMP_MEMORY ? " --cmp-class=memory" : " --cmp-class=compute");
+}
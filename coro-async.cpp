@@ -0,0 +1,289 @@
+/* 
+ * Author: Lorenzo Beretta <lorenzo2beretta@gmail.com> 
+ * Date:   June 2020
+ */
+/* 
+REMARK: All this code is written to sort a vector of integer, however it can 
+be easily generalized using templates, in fact we only need that a binary 
+operator < implementing a total order relation is implemented over vector 
+elements' type.
+*/
+/*
+In this version each of the nb chunks is a C++20 coroutine, so that nb can
+be much larger than nw: a suspended chunk costs a coroutine frame, not a
+thread stack. A chunk performs one pass, then co_awaits its neighbours'
+pass counters and is resumed by one of the nw workers as soon as they are
+ready. The dependency rule is the same one enforced by masterStage in
+ff-farm.cpp, but it is evaluated locally by the chunks themselves.
+*/
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <coroutine>
+#include "ringq.hpp"
+#include "wait.hpp"
+#include "cmpcost.hpp"
+#include "roofline.hpp"
+#include "utimer.hpp"
+
+// this function transpose an adjacent pair if it is out-of-order
+template<typename T>
+inline bool transpose(std::vector<T> &v, int ind) {
+    if (v[ind + 1] < v[ind]) {
+	std::swap(v[ind + 1], v[ind]);
+	return true;
+    }
+    return false;
+}
+
+// coroutine type of a chunk: it starts suspended and it is destroyed by
+// the owner once the executor has shut down
+struct chunk_task {
+    struct promise_type {
+	chunk_task get_return_object() {
+	    return {std::coroutine_handle<promise_type>::from_promise(*this)};
+	}
+	std::suspend_always initial_suspend() noexcept { return {}; }
+	std::suspend_always final_suspend() noexcept { return {}; }
+	void return_void() {}
+	void unhandled_exception() { std::terminate(); }
+    };
+    std::coroutine_handle<promise_type> h;
+};
+
+// chunk state, padded so that neighbouring chunks do not share cache lines
+struct alignas(64) chunk {
+    int st;
+    int en;
+    // number of passes completed on this chunk
+    std::atomic<int> done{0};
+    // mtx protects waiter, the handle of the suspended coroutine (if any)
+    std::mutex mtx;
+    std::coroutine_handle<> waiter;
+};
+
+// bookkeeping of a pass, to detect two consecutive clean passes
+struct alignas(64) pass_info {
+    std::atomic<int> finished{0};
+    std::atomic<int> dirty{0};
+};
+
+template<typename T>
+class oesort_coro {
+    std::vector<T> &v;
+    const int n;
+    const int nw;
+    int nb;
+    std::vector<chunk> chunks;
+    // passes are tracked in a ring: since |done[i] - done[i + 1]| <= 1,
+    // at most nb passes are in flight at any time
+    std::vector<pass_info> ring;
+    int clean_streak = 0;  // only written by the last chunk ending a pass
+    std::atomic<bool> stop{false};
+    std::atomic<int> nfinished{0};
+    // each chunk is queued at most once, so nb + nw slots are enough;
+    // idle workers wait on it with the --wait policy
+    mpmc_ring<std::coroutine_handle<>> ready;
+
+    // ---------------------------- INVARIANT --------------------------
+    // chunk i starts pass p only if both its neighbours completed p
+    // passes. Since the same holds for the neighbours, concurrently
+    // running neighbours are in the same pass, hence they work on
+    // disjoint pairs, and the sequence of transpositions applied to
+    // each pair is exactly the one of oesort_seq.
+    bool can_run(int i, int p) {
+	return stop.load(std::memory_order_acquire) ||
+	    ((i == 0 || chunks[i - 1].done.load(std::memory_order_acquire) >= p) &&
+	     (i == nb - 1 || chunks[i + 1].done.load(std::memory_order_acquire) >= p));
+    }
+
+    struct neighbours_ready {
+	oesort_coro &s;
+	int i;
+	int p;
+	bool await_ready() { return s.can_run(i, p); }
+	bool await_suspend(std::coroutine_handle<> h) {
+	    std::lock_guard<std::mutex> lk(s.chunks[i].mtx);
+	    // check again under the lock, a neighbour may have advanced
+	    if (s.can_run(i, p))
+		return false;
+	    s.chunks[i].waiter = h;
+	    return true;
+	}
+	void await_resume() {}
+    };
+
+    // resume chunk j if it is suspended and its neighbours are ready
+    void wake(int j) {
+	if (j < 0 || j >= nb) return;
+	std::coroutine_handle<> h;
+	{
+	    std::lock_guard<std::mutex> lk(chunks[j].mtx);
+	    if (chunks[j].waiter && can_run(j, chunks[j].done.load())) {
+		h = chunks[j].waiter;
+		chunks[j].waiter = nullptr;
+	    }
+	}
+	if (h) ready.push(h);
+    }
+
+    // called by every chunk at the end of pass p, the last one to end it
+    // decides whether the vector is sorted
+    void end_pass(int p, bool swapped) {
+	pass_info &pi = ring[p % ring.size()];
+	if (swapped)
+	    pi.dirty.fetch_add(1, std::memory_order_relaxed);
+	if (pi.finished.fetch_add(1, std::memory_order_acq_rel) == nb - 1) {
+	    clean_streak = pi.dirty.load(std::memory_order_relaxed) ? 0 : clean_streak + 1;
+	    // the slot is reused for pass p + ring.size()
+	    pi.dirty.store(0, std::memory_order_relaxed);
+	    pi.finished.store(0, std::memory_order_relaxed);
+	    // a clean odd pass followed by a clean even pass (or vice versa)
+	    // means that the vector is sorted
+	    if (clean_streak >= 2 || p == n - 1) {
+		stop.store(true, std::memory_order_release);
+		for (int j = 0; j < nb; ++j)
+		    wake(j);
+	    }
+	}
+    }
+
+    chunk_task body(int i) {
+	chunk &c = chunks[i];
+	for (int p = 0; !stop.load(std::memory_order_acquire); ++p) {
+	    co_await neighbours_ready{*this, i, p};
+	    if (stop.load(std::memory_order_acquire))
+		break;
+	    // odd phase first, as in oesort_seq
+	    bool swapped = false;
+	    for (int j = c.st + ((c.st & 1) ^ (~p & 1)); j < c.en; j += 2)
+		swapped |= transpose(v, j);
+	    end_pass(p, swapped);
+	    c.done.store(p + 1, std::memory_order_release);
+	    wake(i - 1);
+	    wake(i + 1);
+	}
+	// the last chunk to end shuts down the workers
+	if (nfinished.fetch_add(1) == nb - 1)
+	    for (int j = 0; j < nw; ++j)
+		ready.push(std::coroutine_handle<>());
+    }
+
+public:
+    oesort_coro(std::vector<T> &v, int nw, int nb)
+	: v(v), n(v.size()), nw(nw), ready(nb + nw) {
+	int delta = n / nb;
+	int reminder = n % nb;
+	// define chunk bundaries so that they are perfectly balanced
+	// (i.e. |env[i] - env[j] - stv[i] + stv[j]| <= 1 for each i and j) 
+	std::vector<int> stv, env;
+	for (int i = 0; i < n; i += delta) {
+	    stv.push_back(i);
+	    if (reminder-- > 0) i++;
+	    env.push_back((i + delta < n) ? (i + delta) : (n - 1));
+	}
+	this->nb = stv.size();
+	chunks = std::vector<chunk>(this->nb);
+	for (int i = 0; i < this->nb; ++i) {
+	    chunks[i].st = stv[i];
+	    chunks[i].en = env[i];
+	}
+	ring = std::vector<pass_info>(this->nb + 2);
+    }
+
+    // it returns the memory traffic of the passes
+    traffic run() {
+	std::vector<chunk_task> tasks;
+	for (int i = 0; i < nb; ++i) {
+	    tasks.push_back(body(i));
+	    ready.push(tasks.back().h);
+	}
+
+	auto worker = [&]() {
+			  while (true) {
+			      std::coroutine_handle<> h = ready.pop();
+			      if (!h) break;  // EOS
+			      h.resume();
+			  }
+		      };
+	// spawn threads
+	std::vector<std::thread*> tids(nw);
+	for (int i = 0; i < nw; ++i)
+	    tids[i] = new std::thread(worker);
+	// join threads and destruct thread objects
+	for (int i = 0; i < nw; ++i) {
+	    tids[i]->join();
+	    delete tids[i];
+	}
+	for (auto &t : tasks)
+	    t.h.destroy();
+	traffic t;
+	for (auto &c : chunks)
+	    t.pass(c.en - c.st + 1, sizeof(T), c.done.load());
+	return t;
+    }
+};
+
+template<typename T>
+traffic oesort_coroutines(std::vector<T> &v, int nw, int nb) {
+    if (v.size() < 2) return traffic();
+    nb = std::max(1, std::min(nb, (int) v.size() / 2));
+    return oesort_coro<T>(v, nw, nb).run();
+}
+
+// fill, sort and check a vector of T
+template<typename T>
+int run(const int nw, const int n, const int seed, const int nb,
+	const std::string &message) {
+    // seed allows to set up fair experiments
+    srand(seed);
+    std::vector<T> v(n);
+    for (auto &z : v) z = rand();
+    
+    traffic t;
+    long usec;
+    {
+	utimer timer(message, &usec);
+	t = oesort_coroutines(v, nw, nb);
+    }
+
+    // check that the algorithm is correct
+    if (!std::is_sorted(v.begin(), v.end())) {
+	std::cout << "VECTOR IS NOT SORTED!" << std::endl;
+	return -1;
+    }
+    wait_report();
+    if (roofline_enabled())
+	roofline_report<T>(t, n, usec, nw);
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    roofline_args(argc, argv);
+    if (!cmp_cost_args(argc, argv) || !wait_args(argc, argv) || argc < 4) {
+	std::cerr << "use: " << argv[0];
+	std::cerr << " nworkers vector-length seed [nchunks] [--wait=spin|yield|futex|block]";
+	std::cerr << " [--cmp-cost=ns] [--cmp-class=compute|memory] [--roofline]\n";
+	return -1;
+    }
+ 
+    const int nw = std::stol(argv[1]);
+    const int n = std::stol(argv[2]);
+    const int seed = std::stol(argv[3]);
+    const int nb = (argc == 5) ? std::stol(argv[4]) : 16 * nw;
+    // writing a message, a useful log for managing experiments
+    std::string message = argv[0];
+    for (int i = 1; i < argc; ++i)
+	message += ' ' + std::string(argv[i]);
+    message += wait_describe();
+    message += cmp_cost_describe();
+
+    // comparisons of costly_int burn the requested amount of work
+    if (cmp_cost_enabled())
+	return run<costly_int>(nw, n, seed, nb, message);
+    return run<int>(nw, n, seed, nb, message);
+}
@@ -0,0 +1,475 @@
+/* 
+ * Author: Lorenzo Beretta <lorenzo2beretta@gmail.com> 
+ * Date:   June 2020
+ */
+/* 
+REMARK: All this code is written to sort a vector of integer, however it can 
+be easily generalized using templates, in fact we only need that a binary 
+operator < implementing a total order relation is implemented over vector 
+elements' type.
+*/
+/*
+This is a distributed version of odd-even sort, the block variant where
+every element is replaced by a shard: np processes (ranks) each own a
+contiguous shard, sort it locally and then run merge-split phases with
+rank +- 1 only. In phase p the ranks r and r + 1 with r == p (mod 2)
+first exchange their boundary elements, and only if they are out of
+order the lower rank sends the elements that may move right and the
+upper one those that may move left; then the lower rank keeps the
+smallest elements and the upper one the largest.
+
+A coordinator plays the role of cnt in pthread-async.cpp: ranks report
+whether each phase changed their shard, and since a quiet odd phase
+followed by a quiet even phase means that the vector is sorted, the
+coordinator then tells every rank the phase to stop at. Ranks may run
+at most LAG phases ahead of the last phase reported by everybody, so
+that the stop phase can be chosen ahead of all of them.
+
+The launcher forks all ranks on localhost and connects neighbours
+with either Unix domain sockets or TCP. To hold more data than one box,
+the ranks run on separate hosts instead: a coordinator process listens
+on a port, every rank is started on its own host with its rank number
+and the coordinator's address, and reports the port on which it accepts
+its left neighbour; once all np ranks are in, the coordinator sends
+each of them the job and the address of its right neighbour, and the
+neighbours connect to each other over TCP.
+*/
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <string>
+#include <array>
+#include <cstdint>
+#include <csignal>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include "cmpcost.hpp"
+#include "merge.hpp"
+#include "utimer.hpp"
+
+const int LAG = 4;
+
+// messages from a rank to the coordinator
+const int READY = -1;    // data generated, waiting for the start
+const int CHECKED = -2;  // final check done, changed tells whether it failed
+struct report {
+    int phase;
+    int changed;
+};
+
+// messages from the coordinator to a rank: phases [0, limit) may be run,
+// and if final is set the rank stops at limit
+struct grant {
+    int limit;
+    int final;
+};
+
+// with ranks on separate hosts, a rank introduces itself with the port
+// on which it accepts its left neighbour, and the coordinator answers
+// with the job and the address of the right neighbour
+struct hello {
+    int rank;
+    int np;
+    int port;
+};
+struct setup {
+    int n;
+    int seed;
+    sockaddr_in right;
+};
+
+void die(const std::string &what) {
+    perror(what.c_str());
+    exit(-1);
+}
+
+void write_all(int fd, const void *buf, size_t len) {
+    const char *p = (const char *) buf;
+    while (len > 0) {
+	ssize_t k = send(fd, p, len, MSG_NOSIGNAL);
+	if (k <= 0) die("send");
+	p += k;
+	len -= k;
+    }
+}
+
+void read_all(int fd, void *buf, size_t len) {
+    char *p = (char *) buf;
+    while (len > 0) {
+	ssize_t k = recv(fd, p, len, 0);
+	if (k <= 0) die("recv");
+	p += k;
+	len -= k;
+    }
+}
+
+template<typename T>
+void send_val(int fd, const T &x) { write_all(fd, &x, sizeof(x)); }
+
+template<typename T>
+T recv_val(int fd) {
+    T x;
+    read_all(fd, &x, sizeof(x));
+    return x;
+}
+
+// elements are sent as raw bytes, T must be trivially copyable
+template<typename T>
+void send_vec(int fd, const T *v, int64_t len) {
+    send_val(fd, len);
+    write_all(fd, v, len * sizeof(T));
+}
+
+template<typename T>
+std::vector<T> recv_vec(int fd) {
+    std::vector<T> v(recv_val<int64_t>(fd));
+    read_all(fd, v.data(), v.size() * sizeof(T));
+    return v;
+}
+
+// merge-split with the upper neighbour: keep the smallest elements,
+// returns whether the shard changed
+template<typename T>
+bool split_low(std::vector<T> &s, int fd) {
+    send_val(fd, s.back());
+    const T their_min = recv_val<T>(fd);
+    if (s.back() <= their_min)
+	return false;  // quiet boundary
+    // only our elements greater than their minimum can move right
+    // (lower rank sends first, so that bulk transfers cannot deadlock)
+    auto it = std::upper_bound(s.begin(), s.end(), their_min);
+    send_vec(fd, &*it, s.end() - it);
+    std::vector<T> in = recv_vec<T>(fd);
+    // the first s.size() elements of the merge, ours first on ties
+    std::vector<T> m(s.size());
+    merge_range(s.data(), s.size(), in.data(), in.size(), m.data(), 0, m.size());
+    s.swap(m);
+    return true;
+}
+
+// merge-split with the lower neighbour: keep the largest elements,
+// returns whether the shard changed
+template<typename T>
+bool split_high(std::vector<T> &s, int fd) {
+    send_val(fd, s.front());
+    const T their_max = recv_val<T>(fd);
+    if (their_max <= s.front())
+	return false;  // quiet boundary
+    // only our elements less than their maximum can move left
+    std::vector<T> in = recv_vec<T>(fd);
+    auto it = std::lower_bound(s.begin(), s.end(), their_max);
+    send_vec(fd, s.data(), it - s.begin());
+    // the last s.size() elements of the merge, theirs first on ties
+    std::vector<T> m(s.size());
+    merge_range(in.data(), in.size(), s.data(), s.size(), m.data(), in.size(), in.size() + s.size());
+    s.swap(m);
+    return true;
+}
+
+template<typename T>
+void rank_body(int r, int np, int n, int seed, int left, int right, int ctrl) {
+    // shards are balanced as in the other engines
+    const int64_t lo = (int64_t) n * r / np;
+    const int64_t hi = (int64_t) n * (r + 1) / np;
+    // every rank draws the same sequence as the other engines,
+    // keeping only its own shard
+    srand(seed);
+    for (int64_t i = 0; i < lo; ++i) rand();
+    std::vector<T> s(hi - lo);
+    for (auto &z : s) z = rand();
+
+    send_val(ctrl, report{READY, 0});
+    grant g = recv_val<grant>(ctrl);
+    std::sort(s.begin(), s.end());
+    for (int p = 0; ; ++p) {
+	while (p == g.limit) {
+	    if (g.final) goto done;
+	    g = recv_val<grant>(ctrl);
+	}
+	bool changed = false;
+	if ((r & 1) == (p & 1)) {
+	    if (right >= 0) changed = split_low(s, right);
+	}
+	else {
+	    if (left >= 0) changed = split_high(s, left);
+	}
+	send_val(ctrl, report{p, changed});
+    }
+ done:
+    // final check: sorted shards with ordered boundaries
+    bool ok = std::is_sorted(s.begin(), s.end());
+    if (right >= 0) send_val(right, s.back());
+    if (left >= 0) ok &= recv_val<T>(left) <= s.front();
+    send_val(ctrl, report{CHECKED, !ok});
+}
+
+// ---------------------------- INVARIANT --------------------------
+// acked is the number of phases reported by every rank; a phase is
+// clean iff no rank changed its shard in it. Two consecutive clean
+// phases imply that the vector is sorted, exactly as sorted[] for
+// every chunk does in pthread-async.cpp.
+bool coordinator(int np, std::vector<int> &ctrl, const std::string &message) {
+    for (int r = 0; r < np; ++r)
+	if (recv_val<report>(ctrl[r]).phase != READY) die("handshake");
+
+    // np phases are always enough for block odd-even sort
+    std::vector<int> nrep(np + 1), dirty(np + 1);
+    int acked = 0;
+    int clean_streak = 0;
+    grant g{std::min(np, LAG), LAG >= np};
+    bool ok = true;
+    {
+	utimer timer(message);
+	for (int r = 0; r < np; ++r) send_val(ctrl[r], g);
+	std::vector<pollfd> pfd(np);
+	for (int r = 0; r < np; ++r) pfd[r] = {ctrl[r], POLLIN, 0};
+	int nchecked = 0;
+	while (nchecked < np) {
+	    if (poll(pfd.data(), np, -1) < 0) die("poll");
+	    for (int r = 0; r < np; ++r) {
+		if (!(pfd[r].revents & (POLLIN | POLLHUP))) continue;
+		report rp = recv_val<report>(ctrl[r]);
+		if (rp.phase == CHECKED) {
+		    ok &= !rp.changed;
+		    ++nchecked;
+		    // the rank is done and may hang up
+		    pfd[r].fd = -1;
+		    continue;
+		}
+		nrep[rp.phase]++;
+		dirty[rp.phase] |= rp.changed;
+	    }
+	    if (g.final) continue;
+	    // advance acked over the phases reported by everybody
+	    bool moved = false;
+	    while (acked < np && nrep[acked] == np) {
+		clean_streak = dirty[acked] ? 0 : clean_streak + 1;
+		++acked;
+		moved = true;
+		if (clean_streak >= 2) break;
+	    }
+	    if (!moved) continue;
+	    g.limit = std::min(np, acked + LAG);
+	    g.final = (clean_streak >= 2) || g.limit == np;
+	    for (int r = 0; r < np; ++r) send_val(ctrl[r], g);
+	}
+    }
+    return ok;
+}
+
+void no_delay(int fd) {
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+// a connected TCP pair on localhost, the two ends are given to two ranks
+void tcp_pair(int fds[2]) {
+    int ls = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;  // any free port
+    socklen_t len = sizeof(addr);
+    if (ls < 0 || bind(ls, (sockaddr *) &addr, len) < 0 || listen(ls, 1) < 0 ||
+	getsockname(ls, (sockaddr *) &addr, &len) < 0) die("listen");
+    fds[1] = socket(AF_INET, SOCK_STREAM, 0);
+    if (fds[1] < 0 || connect(fds[1], (sockaddr *) &addr, len) < 0) die("connect");
+    fds[0] = accept(ls, NULL, NULL);
+    if (fds[0] < 0) die("accept");
+    close(ls);
+    for (int i : {0, 1})
+	no_delay(fds[i]);
+}
+
+// a socket listening on port (0 for any free one) of every interface
+int tcp_listen(int port, int backlog) {
+    int ls = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (ls < 0 || setsockopt(ls, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0 ||
+	bind(ls, (sockaddr *) &addr, sizeof(addr)) < 0 || listen(ls, backlog) < 0)
+	die("listen");
+    return ls;
+}
+
+int tcp_connect(const sockaddr_in &addr) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (const sockaddr *) &addr, sizeof(addr)) < 0)
+	die("connect");
+    no_delay(fd);
+    return fd;
+}
+
+// the IPv4 address of host:port
+sockaddr_in resolve(const std::string &where) {
+    const size_t colon = where.rfind(':');
+    addrinfo hints = {}, *res;
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (colon == std::string::npos ||
+	getaddrinfo(where.substr(0, colon).c_str(), where.substr(colon + 1).c_str(), &hints, &res) != 0) {
+	std::cerr << "cannot resolve " << where << '\n';
+	exit(-1);
+    }
+    sockaddr_in addr = *(sockaddr_in *) res->ai_addr;
+    freeaddrinfo(res);
+    return addr;
+}
+
+// ---------------------------- SEPARATE HOSTS ----------------------
+// the coordinator accepts np ranks on port and returns their control
+// sockets, indexed by rank; a rank is reached by its neighbour at the
+// address it connected from
+std::vector<int> gather_ranks(int port, int np, int n, int seed) {
+    int ls = tcp_listen(port, np);
+    std::vector<int> ctrl(np, -1);
+    std::vector<sockaddr_in> at(np);
+    for (int k = 0; k < np; ++k) {
+	sockaddr_in peer;
+	socklen_t len = sizeof(peer);
+	int c = accept(ls, (sockaddr *) &peer, &len);
+	if (c < 0) die("accept");
+	no_delay(c);
+	hello h = recv_val<hello>(c);
+	if (h.np != np || h.rank < 0 || h.rank >= np || ctrl[h.rank] >= 0) {
+	    std::cerr << "unexpected rank " << h.rank << " of " << h.np << '\n';
+	    exit(-1);
+	}
+	ctrl[h.rank] = c;
+	at[h.rank] = peer;
+	at[h.rank].sin_port = htons(h.port);
+    }
+    close(ls);
+    for (int r = 0; r < np; ++r)
+	send_val(ctrl[r], setup{n, seed, (r < np - 1) ? at[r + 1] : sockaddr_in{}});
+    return ctrl;
+}
+
+// rank r of np, reaching the coordinator at host:port
+template<typename T>
+void remote_rank(int r, int np, const std::string &coordinator) {
+    // listen before saying hello, the left neighbour may connect at once
+    int ls = tcp_listen(0, 1);
+    sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    if (getsockname(ls, (sockaddr *) &addr, &len) < 0) die("getsockname");
+    int ctrl = tcp_connect(resolve(coordinator));
+    send_val(ctrl, hello{r, np, ntohs(addr.sin_port)});
+    const setup su = recv_val<setup>(ctrl);
+    int left = -1, right = -1;
+    // connect first: the listener of the right neighbour already queues it
+    if (r < np - 1)
+	right = tcp_connect(su.right);
+    if (r > 0) {
+	left = accept(ls, NULL, NULL);
+	if (left < 0) die("accept");
+	no_delay(left);
+    }
+    close(ls);
+    rank_body<T>(r, np, su.n, su.seed, left, right, ctrl);
+}
+
+int main(int argc, char* argv[]) {
+    const std::string mode = (argc > 1) ? argv[1] : "";
+    if (!cmp_cost_args(argc, argv) || argc < 4 ||
+	(mode == "coordinator" && argc < 6) || (mode == "rank" && argc < 5)) {
+	std::cerr << "use: " << argv[0];
+	std::cerr << " nprocesses vector-length seed [transport (unix or tcp)]";
+	std::cerr << " [--cmp-cost=ns] [--cmp-class=compute|memory]\n";
+	std::cerr << "     " << argv[0] << " coordinator port nprocesses vector-length seed\n";
+	std::cerr << "     " << argv[0] << " rank rank nprocesses coordinator-host:port";
+	std::cerr << " [--cmp-cost=ns] [--cmp-class=compute|memory]\n";
+	return -1;
+    }
+    // writing a message, a useful log for managing experiments
+    std::string message = argv[0];
+    for (int i = 1; i < argc; ++i)
+	message += ' ' + std::string(argv[i]);
+    message += cmp_cost_describe();
+
+    if (mode == "rank") {
+	// the comparison cost is calibrated on the host of the rank
+	const int r = std::stol(argv[2]);
+	const int np = std::stol(argv[3]);
+	if (cmp_cost_enabled())
+	    remote_rank<costly_int>(r, np, argv[4]);
+	else
+	    remote_rank<int>(r, np, argv[4]);
+	return 0;
+    }
+
+    const int first = (mode == "coordinator") ? 3 : 1;
+    const int np = std::stol(argv[first]);
+    const int n = std::stol(argv[first + 1]);
+    const int seed = std::stol(argv[first + 2]);
+    if (np < 1 || n < np) {
+	std::cerr << "every process needs at least one element\n";
+	return -1;
+    }
+
+    if (mode == "coordinator") {
+	std::vector<int> cfd = gather_ranks(std::stol(argv[2]), np, n, seed);
+	if (!coordinator(np, cfd, message)) {
+	    std::cout << "VECTOR IS NOT SORTED!" << std::endl;
+	    return -1;
+	}
+	return 0;
+    }
+
+    const std::string transport = (argc == 5) ? argv[4] : "unix";
+    if (transport != "unix" && transport != "tcp") {
+	std::cerr << "unknown transport " << transport << '\n';
+	return -1;
+    }
+
+    // link[i] connects rank i (end 0) and rank i + 1 (end 1),
+    // ctrl[i] connects the coordinator (end 0) and rank i (end 1)
+    std::vector<std::array<int, 2>> link(np - 1), ctrl(np);
+    for (auto &l : link) {
+	if (transport == "tcp")
+	    tcp_pair(l.data());
+	else if (socketpair(AF_UNIX, SOCK_STREAM, 0, l.data()) < 0)
+	    die("socketpair");
+    }
+    for (auto &c : ctrl)
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, c.data()) < 0) die("socketpair");
+
+    // spawn ranks
+    std::vector<pid_t> pids(np);
+    for (int r = 0; r < np; ++r) {
+	pids[r] = fork();
+	if (pids[r] < 0) die("fork");
+	if (pids[r] == 0) {
+	    int left = (r > 0) ? link[r - 1][1] : -1;
+	    int right = (r < np - 1) ? link[r][0] : -1;
+	    // ranks inherit the calibrated comparison cost
+	    if (cmp_cost_enabled())
+		rank_body<costly_int>(r, np, n, seed, left, right, ctrl[r][1]);
+	    else
+		rank_body<int>(r, np, n, seed, left, right, ctrl[r][1]);
+	    _exit(0);
+	}
+    }
+    std::vector<int> cfd(np);
+    for (int r = 0; r < np; ++r) cfd[r] = ctrl[r][0];
+    bool ok = coordinator(np, cfd, message);
+    for (int r = 0; r < np; ++r)
+	waitpid(pids[r], NULL, 0);
+
+    // check that the algorithm is correct
+    if (!ok) {
+	std::cout << "VECTOR IS NOT SORTED!" << std::endl;
+	return -1;
+    }
+    return 0;
+}
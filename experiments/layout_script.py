@@ -0,0 +1,37 @@
+import subprocess
+import sys
+from statistics import mean
+
+# before and after numbers of the memory layouts of pthread-async:
+# packed is the original one, aligned pads the per-chunk state and puts
+# chunk boundaries on cache lines, huge adds transparent huge pages.
+# usage: python3 layout_script.py [binary] [vector-length] [seeds] [max-nw]
+
+binary = sys.argv[1] if len(sys.argv) > 1 else '../pthread-async'
+n = int(sys.argv[2]) if len(sys.argv) > 2 else 100000
+seeds = int(sys.argv[3]) if len(sys.argv) > 3 else 5
+max_nw = int(sys.argv[4]) if len(sys.argv) > 4 else 16
+
+layouts = ['packed', 'aligned', 'huge']
+nws = [1]
+while nws[-1] * 2 <= max_nw:
+    nws.append(nws[-1] * 2)
+
+usec = {}
+for nw in nws:
+    for layout in layouts:
+        ll = []
+        for seed in range(1, seeds + 1):
+            out = subprocess.run([binary, str(nw), str(n), str(seed), layout],
+                                 capture_output=True, text=True, check=True).stdout
+            # ./pthread-async nw n seed layout computed in usec usec
+            z = [l for l in out.splitlines() if 'computed in' in l][0].split()
+            ll.append(int(z[z.index('computed') + 2]))
+        usec[nw, layout] = mean(ll)
+
+print(f'mean usec over {seeds} seeds, n = {n}')
+print(f'{"nw":>4}' + ''.join(f'{l:>12}' for l in layouts) +
+      ''.join(f'{l + " speedup":>16}' for l in layouts[1:]))
+for nw in nws:
+    print(f'{nw:>4}' + ''.join(f'{usec[nw, l]:>12.0f}' for l in layouts) +
+          ''.join(f'{usec[nw, "packed"] / usec[nw, l]:>16.2f}' for l in layouts[1:]))
@@ -12,37 +12,110 @@ elements' type.
 #include <iostream>
 #include <vector>
 #include <algorithm>
+#include <memory>
+#include <cstring>
+#include <chrono>
 #include <ff/ff.hpp>
 #include <ff/farm.hpp>
+#include "cmpcost.hpp"
+#include "roofline.hpp"
+#include "kvpair.hpp"
+#include "checkpoint.hpp"
+#include "topk.hpp"
 #include "utimer.hpp"
 
 using namespace ff;
 
-// this function transpose an adjacent pair if it is out-of-order
-void transpose(std::vector<int> &v, int ind) {
-    if (v[ind + 1] < v[ind])
-	std::swap(v[ind + 1], v[ind]);
-}
+// ---------------------------- GHOST CELLS --------------------------
+// A task carries k passes over a block, that is an epoch. Since a pass
+// propagates information by one position, k passes over the block
+// extended by k elements on each side (the halo) compute the exact
+// values of the block's own elements: the halo is recomputed
+// redundantly by both neighbours and thrown away.
+// Epoch e reads buf[e & 1] and writes the block's own elements into
+// buf[(e + 1) & 1]. Block i runs epoch e only once i - 1 and i + 1
+// completed e epochs: thus nobody is still reading buf[(e + 1) & 1]
+// around block i and the halo read from buf[e & 1] is up to date.
+// Blocks must be at least k elements long, so that a halo never
+// reaches past the adjacent blocks.
+// As a consequence every element goes through exactly the same
+// sequence of values as in oesort_seq, pass after pass.
+
+// ---------------------------- TERMINATION --------------------------
+// Pair (j, j + 1) belongs to the block owning j, and the values of its
+// elements are exact during every pass of an epoch. Workers report the
+// last pass in which they swapped one of their own pairs, so that the
+// emitter knows since which pass each block is clean. If every block
+// is clean during the same two consecutive passes, an odd and an even
+// one, the vector is sorted and every later pass is useless.
+
+// ---------------------------- CHECKPOINTS --------------------------
+// The emitter's state is a consistent cut of the sort: block i has
+// completed npass[i] epochs and its elements are in buf[npass[i] & 1],
+// which nobody writes until the next epoch of block i is over. A block
+// lagging behind a neighbour will read the neighbour's halo from the
+// other buffer, which the neighbour cannot be writing since it waits
+// for the lagging block. So the emitter checkpoints both buffers,
+// except the region a busy block is writing, with npass and clean,
+// and the farm restarts from this per-block frontier.
+
+// ---------------------------- READY BLOCKS -------------------------
+// The neighbour rule makes readiness local: when block i returns only
+// npass[i] has changed, so only blocks i - 1, i and i + 1 can have
+// become ready, and every other ready block was already sent when it
+// became so. The termination test is kept local as well: clean_from
+// only grows and the frontier is the lowest npass, tracked with the
+// number of blocks at each npass level. Thus the emitter spends O(1)
+// per task, however many blocks there are.
 
-struct task {
+// workers write their task's dirty field, so tasks of different blocks
+// must not share a cache line
+struct alignas(64) task {
     int blk;
-    int st;
-    int en;
-    int parity;  
-    task(int b, int s, int e, int p): blk(b), st(s), en(e), parity(p) {};
+    int st;      // first own element
+    int en;      // one past the last own element
+    int epoch;
+    int k;       // passes to perform
+    int dirty;   // last pass swapping one of the block's pairs, -1 if none
+    task() {};
+    task(int b, int s, int e): blk(b), st(s), en(e), epoch(0), k(0), dirty(-1) {};
 };
 
+template<typename T>
 struct masterStage: ff_node_t<task> {
     const int n;
     const int nw;
     const int nb;
-    std::vector<int> &v;
+    const int k;
+    const int nepochs;
     std::vector<int> stv, env;
-    std::vector<int> npass;
+    // tasks are allocated once, one per block, and recycled
+    std::vector<task> tasks;
+    std::vector<int> npass;  // epochs completed by each block
     std::vector<bool> busy;
+    // clean[i] is the first pass since which block i has been clean
+    std::vector<int> clean;
     int tot_npass = 0;
+    // level[e] counts the blocks having completed e epochs, the lowest
+    // non-empty one is min_npass
+    std::vector<int> level;
+    int min_npass = 0;
+    int clean_from = 0;
+    // time spent in svc, to show that it does not grow with nb, and the
+    // part of it spent handing tasks to the farm, which depends on the
+    // queues and on whether a worker has to be woken, not on nb
+    double emitter_sec = 0;
+    double send_sec = 0;
+    long ntasks = 0;
+    // memory traffic in elements: a task loads its block and the halo
+    // and stores the own elements once, however many passes it carries
+    double elems_moved = 0;
+    double elem_passes = 0;
+    T *buf[2];
+    checkpoint *ck;
     
-    masterStage(int n, int nw, int nb, std::vector<int> &v): n(n), nw(nw), nb(nb), v(v) {
+    masterStage(int n, int nw, int nb, int k, T *v, T *tmp, checkpoint *ck):
+	n(n), nw(nw), nb(nb), k(k), nepochs((n + k - 1) / k), buf{v, tmp}, ck(ck) {
 	int delta = n / nb;
 	int reminder = n % nb;
 	// define worker bundaries so that they are perfectly balanced
@@ -50,72 +123,127 @@ struct masterStage: ff_node_t<task> {
 	for (int i = 0; i < n; i += delta) {
 	    stv.push_back(i);
 	    if (reminder-- > 0) i++;
-	    env.push_back((i + delta < n) ? (i + delta) : (n - 1));
+	    env.push_back((i + delta < n) ? (i + delta) : n);
 	}
+	for (int i = 0; i < nb; ++i)
+	    tasks.push_back(task(i, stv[i], env[i]));
 	npass = std::vector<int>(nb);
 	busy = std::vector<bool>(nb);
+	clean = std::vector<int>(nb);
+	if (ck && ck->resumed()) {
+	    const T *data = (const T *) ck->data();
+	    std::memcpy(buf[0], data, n * sizeof(T));
+	    std::memcpy(buf[1], data + n, n * sizeof(T));
+	    for (int i = 0; i < nb; ++i) {
+		npass[i] = ck->meta()[i];
+		clean[i] = ck->meta()[nb + i];
+		tot_npass += npass[i];
+	    }
+	}
+	level = std::vector<int>(nepochs + 1);
+	for (int i = 0; i < nb; ++i) {
+	    level[npass[i]]++;
+	    clean_from = std::max(clean_from, clean[i]);
+	}
+	while (level[min_npass] == 0)
+	    ++min_npass;
     };
 
-    task* send_task(task* ot) {
-	int st = ot->st;
-	int en = ot->en;
-	int parity = ot->parity;
-	int blk = ot->blk;
-
-	// perform boundary transposition first, so
-	// it can immediately start adjacent threads
-	if (!((st ^ parity) & 1))  // check if st == parity (mod 2)
-	    transpose(v, ot->st);
-	if ((en ^ parity) & 1)  // check if en - 1 == parity (mod 2)
-	    transpose(v, en - 1);
-
-	npass[blk]++;
-	// termination case: npass[i] <= n for each i, then tot_npass = n * nb
-	// implies that npass[i] == n for each i
-	if (++tot_npass == n * nb)
-	    return EOS;
+    void save() {
+	ck->save([&](int64_t *meta, void *data) {
+		     T *out = (T *) data;
+		     for (int i = 0; i < nb; ++i) {
+			 meta[i] = npass[i];
+			 meta[nb + i] = clean[i];
+			 const size_t len = (env[i] - stv[i]) * sizeof(T);
+			 for (int b : {0, 1})
+			     if (!busy[i] || b == (npass[i] & 1))
+				 std::memcpy(out + b * n + stv[i], buf[b] + stv[i], len);
+		     }
+		 });
+    }
+
+    void send_task(int blk) {
+	task *ot = &tasks[blk];
+	ot->epoch = npass[blk];
+	// the last epoch may be shorter, n passes are enough to sort
+	ot->k = std::min(k, n - ot->epoch * k);
 	busy[blk] = true;
+	auto start = std::chrono::steady_clock::now();
 	ff_send_out(ot);
-	return ot;
+	send_sec += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
     }
 	
     task* svc(task* it) {
-	// first emission of tasks
+	auto start = std::chrono::steady_clock::now();
+	task *res = step(it);
+	emitter_sec += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	return res;
+    }
+
+    task* step(task* it) {
+	// first emission of tasks, a resumed sort starts from its frontier
 	if (it == NULL) {
-	    for (int i = 0; i < nb; ++i) {
-		task* ot = new task(i, stv[i], env[i], 1);		
-		send_task(ot);
-	    }
+	    for (int i = 0; i < nb; ++i)
+		try_send(i);
 	    return GO_ON;
 	}
 
 	// the task comes from a worker's feedback loop
-	busy[it->blk] = false;
-	delete it;  // prevent memory leaks
-
-	// a worker is possibily idle, it is time to emit some tasks
-	for (int i = 0; i < nb; ++i) {
-	    // ensure that |npass[i] - npass[i + 1]| <= 1 for each i
-	    bool lcond = (i == 0) || (npass[i] <= npass[i - 1]);
-	    bool rcond = (i == nb - 1) || (npass[i] <= npass[i + 1]);
-
-	    // npass[i] < n ensures that npass[i] <= n for each i and
-	    // !busy[i] ensures that each chunk is given to one worker at a time
-	    if (!busy[i] && npass[i] < n && lcond && rcond) {
-		task* ot = new task(i, stv[i], env[i], npass[i]);
-		// termination case
-		if(send_task(ot) == EOS)
-		    return EOS;
-	    }
+	const int blk = it->blk;
+	ntasks++;
+	busy[blk] = false;
+	level[npass[blk]]--;
+	level[++npass[blk]]++;
+	while (level[min_npass] == 0)
+	    ++min_npass;
+	const int own = it->en - it->st;
+	elems_moved += own + std::min(n, it->en + it->k) - std::max(0, it->st - it->k);
+	elem_passes += (double) own * it->k;
+	if (it->dirty >= 0) {
+	    clean[blk] = it->dirty + 1;
+	    clean_from = std::max(clean_from, clean[blk]);
 	}
+	// termination case: npass[i] <= nepochs for each i, then
+	// tot_npass = nepochs * nb implies that npass[i] == nepochs for each i
+	if (++tot_npass == nepochs * nb)
+	    return EOS;
+
+	// early termination case: every block has been clean in passes
+	// [max(clean), min(frontier)), where frontier is the number of
+	// passes completed by a block
+	if (std::min(n, min_npass * k) - clean_from >= 2)
+	    return EOS;
+
+	if (ck && ck->due())
+	    save();
+	// a worker is possibily idle, only the returned block and its
+	// neighbours may have become ready
+	for (int i = std::max(0, blk - 1); i <= std::min(nb - 1, blk + 1); ++i)
+	    try_send(i);
 	return GO_ON;
     }
+
+    void try_send(int i) {
+	// ensure that |npass[i] - npass[i + 1]| <= 1 for each i
+	bool lcond = (i == 0) || (npass[i] <= npass[i - 1]);
+	bool rcond = (i == nb - 1) || (npass[i] <= npass[i + 1]);
+
+	// npass[i] < nepochs ensures that npass[i] <= nepochs for each i and
+	// !busy[i] ensures that each chunk is given to one worker at a time
+	if (!busy[i] && npass[i] < nepochs && lcond && rcond)
+	    send_task(i);
+    }
 };
 
+template<typename T>
 struct workerStage: ff_node_t<task> {
-    std::vector<int> &v;
+    const int n;
+    const int k;
+    T *buf[2];
+    std::vector<T> loc;  // the block plus its halo
 
-    workerStage(std::vector<int> &v): v(v) {};
+    workerStage(int n, int k, T *v, T *tmp): n(n), k(k), buf{v, tmp} {};
 
 # if 0  // this is useful to check that different workers
         // are assigned to different physiscal cores
@@ -127,27 +255,57 @@ struct workerStage: ff_node_t<task> {
 #endif 
     
     task* svc(task* it) {
-	int st = it->st;
-	int en = it->en;
-	// transpose elements in the given chunk having the right parity
-	if ((st ^ it->parity) & 1) st++;
-	for (; st < en; st += 2)
-	    transpose(v, st);
+	const T *in = buf[it->epoch & 1];
+	T *out = buf[(it->epoch + 1) & 1];
+	const int lo = std::max(0, it->st - it->k);
+	const int hi = std::min(n, it->en + it->k);
+	loc.assign(in + lo, in + hi);
+	it->dirty = -1;
+	// loc is indexed from lo: the pairs of a pass start at local indices
+	// of parity (p's parity) ^ (lo & 1)
+	T *l = loc.data();
+	const int st = it->st - lo, en = it->en - lo, len = hi - lo;
+	for (int t = 0; t < it->k; ++t) {
+	    // global pass number, odd phase first as in oesort_seq
+	    int p = it->epoch * k + t;
+	    int parity = ((p & 1) ? 0 : 1) ^ (lo & 1);
+	    // transpose the pairs of the extended block having the right parity,
+	    // the left halo, the block's own pairs and the right halo, so that
+	    // the pass kernel tells whether one of the own pairs was swapped
+	    oe_pass(l, 0, st + 1, parity);
+	    if (oe_pass(l, st, std::min(en + 1, len), parity))
+		it->dirty = p;
+	    oe_pass(l, en, len, parity);
+	}
+	std::copy(loc.begin() + (it->st - lo), loc.begin() + (it->en - lo), out + it->st);
 	return it;
     }
 }; 
 
 
-void oesort_farm(std::vector<int> &v, int nw, int nb) {
-    size_t n = v.size();
+// blocks must be at least k elements long and contain at least one pair
+void farm_shape(const int n, int &nb, int &k) {
+    nb = std::max(1, std::min(nb, n / 2));
+    k = std::max(1, std::min(k, n / nb - 1));
+}
+
+// it returns the memory traffic of the tasks; the emitter checkpoints
+// the sort in ck, whose counters are npass and clean of the nb blocks
+template<typename T>
+traffic oesort_farm(std::vector<T> &v, int nw, int nb, int k, checkpoint *ck = nullptr) {
+    const int n = v.size();
+    traffic t;
+    if (n < 2) return t;
+    farm_shape(n, nb, k);
+    std::vector<T> tmp(n);  // ping-pong buffer
 
     // create self-destroying workers
     std::vector<std::unique_ptr<ff_node>> w;
     for (int i = 0; i < nw; ++i)
-	w.push_back(std::make_unique<workerStage>(v));
+	w.push_back(std::make_unique<workerStage<T>>(n, k, v.data(), tmp.data()));
 
     ff_Farm<task> farm(std::move(w));
-    masterStage master(n, nw, nb, v);
+    masterStage<T> master(n, nw, nb, k, v.data(), tmp.data(), ck);
     farm.add_emitter(master);
     farm.remove_collector();
     farm.wrap_around();
@@ -160,37 +318,112 @@ void oesort_farm(std::vector<int> &v, int nw, int nb) {
     }
 
     farm.ffStats(std::cout);
+    std::cerr << "emitter: " << master.ntasks << " tasks, ";
+    std::cerr << (long) (1e9 * master.emitter_sec / std::max(1L, master.ntasks)) << " ns per task, ";
+    std::cerr << (long) (1e9 * master.send_sec / std::max(1L, master.ntasks)) << " of them in ff_send_out\n";
+
+    // after an odd number of epochs the block lies in the ping-pong buffer,
+    // and with early termination blocks may have different epoch counts
+    for (int i = 0; i < master.nb; ++i)
+	if (master.npass[i] & 1)
+	    std::copy(tmp.begin() + master.stv[i], tmp.begin() + master.env[i],
+		      v.begin() + master.stv[i]);
+    t.elem_passes = master.elem_passes;
+    t.bytes = master.elems_moved * sizeof(T);
+    return t;
+}
+
+// fill, sort and check a vector of T
+template<typename T>
+int run(const int nw, const int n, const int seed, const int nb, const int k,
+	const std::string &message) {
+    // seed allows to set up fair experiments
+    srand(seed);
+    std::vector<T> v(n);
+    fill_random(v);
+    // in top-k mode only the k smallest elements are sorted
+    std::vector<T> input;
+    if (topk_enabled())
+	input = v;
+    const int len = topk_size(n);
+
+    // the shape of the farm is part of the state, nw is not
+    std::unique_ptr<checkpoint> ck;
+    if (checkpoint_enabled() && len >= 2) {
+	int ck_nb = nb, ck_k = k;
+	farm_shape(len, ck_nb, ck_k);
+	ck.reset(new checkpoint("ff-farm " + std::to_string(n) + ' ' + std::to_string(seed) + ' ' +
+				std::to_string(ck_nb) + ' ' + std::to_string(ck_k) + kv_describe() +
+				topk_describe() + cmp_cost_describe(), 2 * len, sizeof(T), 2 * ck_nb));
+    }
+    
+    traffic t;
+    long usec;
+    {
+	utimer timer(message, &usec);
+	if (topk_enabled())
+	    v = topk_select(v, topk_cfg().k, nw);
+	t = oesort_farm(v, nw, nb, k, ck.get());
+	// wide payloads follow their keys
+	kv_finish(v, nw);
+    }
+
+    // check that the algorithm is correct
+    if (!std::is_sorted(v.begin(), v.end())) {
+	std::cout << "VECTOR IS NOT SORTED!" << std::endl;
+	return -1;
+    }
+    if (!kv_check(v)) {
+	std::cout << "PAIRS TORN APART!" << std::endl;
+	return -1;
+    }
+    if (topk_enabled() && !topk_check(input, v)) {
+	std::cout << "NOT THE TOP " << topk_cfg().k << "!" << std::endl;
+	return -1;
+    }
+    if (ck)
+	ck->finish(usec / 1e6);
+    if (roofline_enabled())
+	roofline_report<T>(t, len, usec, nw);
+    return 0;
 }
 
 int main(int argc, char* argv[]) {
-    if (argc < 4) {
+    roofline_args(argc, argv);
+    if (!kv_args(argc, argv) || !cmp_cost_args(argc, argv) || !checkpoint_args(argc, argv) ||
+	!topk_args(argc, argv) || argc < 4) {
         std::cerr << "use: " << argv[0];
-	std::cerr << " nworkers vector-length seed [nblocks]\n";
+	std::cerr << " nworkers vector-length seed [nblocks] [passes-per-task]";
+	std::cerr << " [--kv[=packed|struct] [--kv-payload=bytes]] [--top-k=k]";
+	std::cerr << " [--cmp-cost=ns] [--cmp-class=compute|memory] [--roofline]";
+	std::cerr << " [--checkpoint=file [--checkpoint-every=sec] [--resume]]\n";
         return -1;
     }
  
     const int nw = std::stol(argv[1]);
     const int n = std::stol(argv[2]);
     const int seed = std::stol(argv[3]);
-    const int nb = (argc == 5) ? std::stol(argv[4]) : 2 * nw;
-    // seed allows to set up fair experiments
-    srand(seed);
-    std::vector<int> v(n);
-    for (auto &z : v) z = rand();
+    const int nb = (argc >= 5) ? std::stol(argv[4]) : 2 * nw;
+    const int k = (argc >= 6) ? std::stol(argv[5]) : 8;
     // writing a message, a useful log for managing experiments
     std::string message = argv[0];
     for (int i = 1; i < argc; ++i)
 	message += ' ' + std::string(argv[i]);
-    
-    {
-	utimer timer(message);
-	oesort_farm(v, nw, nb);
-    }
+    message += kv_describe();
+    message += topk_describe();
+    message += cmp_cost_describe();
 
-    // check that the algorithm is correct
-    if (!std::is_sorted(v.begin(), v.end())) {
-	std::cout << "VECTOR IS NOT SORTED!" << std::endl;
+    if (kv_enabled() && cmp_cost_enabled()) {
+	std::cerr << "--kv sorts integer keys\n";
 	return -1;
     }
-    return 0;
+    // pairs packed in a word or in a struct
+    if (kv_cfg().layout == KV_PACKED)
+	return run<kv_pair>(nw, n, seed, nb, k, message);
+    if (kv_cfg().layout == KV_STRUCT)
+	return run<kv_struct>(nw, n, seed, nb, k, message);
+    // comparisons of costly_int burn the requested amount of work
+    if (cmp_cost_enabled())
+	return run<costly_int>(nw, n, seed, nb, k, message);
+    return run<int>(nw, n, seed, nb, k, message);
 }
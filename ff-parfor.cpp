@@ -9,6 +9,8 @@
 #include <cassert>
 #include <ff/ff.hpp>
 #include <ff/parallel_for.hpp>
+#include "cmpcost.hpp"
+#include "roofline.hpp"
 #include "utimer.hpp"
 
 // Here there are two possible data races
@@ -18,8 +20,9 @@
 
 // DOWNSIDE: we create our thread pool every single time!
 // Tremendous overhead!
+// It returns the memory traffic of the passes.
 template<typename T>
-void oesort_parfor(std::vector<T> &v, int nworkers) {
+traffic oesort_parfor(std::vector<T> &v, int nworkers) {
     size_t n = v.size();
     ff::ParallelFor pf(nworkers); 
     bool sorted = false;
@@ -30,37 +33,58 @@ void oesort_parfor(std::vector<T> &v, int nworkers) {
 		    }
 		};
 
+    traffic t;
     while (!sorted) {
 	sorted = true;
+	t.pass(n, sizeof(T), 2);
 	// odd phase
 	pf.parallel_for(1, n - 1, 2, tran, nworkers);
 	// even phase
 	pf.parallel_for(0, n - 1, 2, tran, nworkers);
     }
+    return t;
+}
+
+// fill, sort and check a vector of T
+template<typename T>
+void run(const int nw, const int n, const int seed, const std::string &message) {
+    // seed allows to set up fair experiments
+    srand(seed);
+    std::vector<T> v(n);
+    for (auto &z : v) z = rand();
+    
+    traffic t;
+    long usec;
+    {
+	utimer timer(message, &usec);
+	t = oesort_parfor<T>(v, nw);
+    }
+
+    assert(std::is_sorted(v.begin(), v.end()));
+    if (roofline_enabled())
+	roofline_report<T>(t, n, usec, nw);
 }
 
 int main(int argc, char* argv[]) {
-    if (argc < 4) {
-        std::cerr << "use: " << argv[0]  << " nworkers vector-length seed\n";
+    roofline_args(argc, argv);
+    if (!cmp_cost_args(argc, argv) || argc < 4) {
+        std::cerr << "use: " << argv[0]  << " nworkers vector-length seed";
+	std::cerr << " [--cmp-cost=ns] [--cmp-class=compute|memory] [--roofline]\n";
         return -1;
     }
  
     int nw = std::stol(argv[1]);
     int n = std::stol(argv[2]);
     int seed = std::stol(argv[3]);
-    // seed allows to set up fair experiments
-    srand(seed);
-    std::vector<int> v(n);
-    for (auto &z : v) z = rand();
     std::string message = argv[0];
     for (int i = 1; i < argc; ++i)
 	message += ' ' + std::string(argv[i]);
+    message += cmp_cost_describe();
     
-    {
-	utimer timer(message);
-	oesort_parfor<int>(v, nw);
-    }
-
-    assert(std::is_sorted(v.begin(), v.end()));
+    // comparisons of costly_int burn the requested amount of work
+    if (cmp_cost_enabled())
+	run<costly_int>(nw, n, seed, message);
+    else
+	run<int>(nw, n, seed, message);
     return 0;
 }
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <cstdlib>
+
+// fill v with random values drawn from rand(), so that a seed gives the
+// same input to every engine; element types that are not built from an
+// int (strkey.hpp, kvpair.hpp) overload it
+template<typename V>
+void fill_random(V& v) {
+  for (auto& z : v)
+    z = rand();
+}
@@ -0,0 +1,82 @@
+/*
+ * Author: Lorenzo Beretta <lorenzo2beretta@gmail.com>
+ * Date:   June 2020
+ */
+/*
+Ticks of a ranked list kept by sorted_vector (incremental.hpp): every tick
+moves a fraction of the elements by at most drift positions, as scores
+drifting a little, inserts a few new elements and sorts the vector again
+with resort(). Re-sorting a copy from scratch with std::sort is timed as
+well, as the cost resort() has to beat.
+*/
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include "incremental.hpp"
+#include "utimer.hpp"
+
+int main(int argc, char* argv[]) {
+    if (argc < 4) {
+	std::cerr << "use: " << argv[0];
+	std::cerr << " nworkers vector-length seed [updates-per-tick] [drift] [ticks] [chunk-length]\n";
+	return -1;
+    }
+
+    const int nw = std::stol(argv[1]);
+    const long n = std::stol(argv[2]);
+    const int seed = std::stol(argv[3]);
+    const long updates = (argc >= 5) ? std::stol(argv[4]) : std::max(1L, n / 1000);
+    const long drift = (argc >= 6) ? std::stol(argv[5]) : 64;
+    const int ticks = (argc >= 7) ? std::stol(argv[6]) : 10;
+    const long chunk_len = (argc >= 8) ? std::stol(argv[7]) : 64;
+    // seed allows to set up fair experiments
+    srand(seed);
+    std::vector<int> init(n);
+    for (auto &z : init) z = rand();
+    sorted_vector<int> sv(init, nw, chunk_len);
+    // writing a message, a useful log for managing experiments
+    std::string message = argv[0];
+    for (int i = 1; i < argc; ++i)
+	message += ' ' + std::string(argv[i]);
+
+    long inc_usec = 0, full_usec = 0;
+    for (int t = 0; t < ticks; ++t) {
+	// the value of an element at most drift positions away, so that
+	// it moves by at most drift positions
+	for (long u = 0; u < updates; ++u) {
+	    long i = rand() % sv.size();
+	    long j = std::min<long>(sv.size() - 1, std::max(0L, i + rand() % (2 * drift + 1) - drift));
+	    sv.update(i, sv[j]);
+	}
+	std::vector<int> fresh(updates / 16);
+	for (auto &z : fresh) z = rand();
+	sv.insert_batch(fresh);
+
+	std::vector<int> copy = sv.data();
+	long usec;
+	resort_stats st;
+	{
+	    utimer timer(message + " tick " + std::to_string(t) + " resort", &usec);
+	    st = sv.resort();
+	}
+	inc_usec += usec;
+	std::cerr << st.activated << " chunks activated, " << st.scans << " scans, ";
+	std::cerr << st.swaps << " swaps\n";
+	{
+	    utimer timer(message + " tick " + std::to_string(t) + " std::sort", &usec);
+	    std::sort(copy.begin(), copy.end());
+	}
+	full_usec += usec;
+
+	// check that the algorithm is correct
+	if (sv.data() != copy) {
+	    std::cout << "VECTOR IS NOT SORTED!" << std::endl;
+	    return -1;
+	}
+    }
+    std::cout << message << " resort " << inc_usec << " usec, std::sort " << full_usec;
+    std::cout << " usec over " << ticks << " ticks" << std::endl;
+    return 0;
+}
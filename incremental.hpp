@@ -0,0 +1,246 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+
+//
+// sorted_vector keeps a vector sorted under point updates and batched
+// insertions. It uses the chunks of pthread-async.cpp, but chunks are
+// not bound to workers: update() and insert_batch() only record the
+// positions they touched, and resort() activates the chunks holding
+// them. A pool of workers scans active chunks (an odd and an even pass)
+// and activates a neighbour whenever a transposition changes one of the
+// elements it shares with it, so that the work follows the displaced
+// elements and scales with the displacement, not with the size.
+//
+// Chunk c owns the pairs (i, i + 1) with stv[c] <= i < env[c], where
+// env[c] == stv[c + 1]: neighbours share one element, v[stv[c + 1]],
+// which is protected by the mutex of chunk c + 1 as in pthread-async.
+//
+// ---------------------------- INVARIANT --------------------------
+// When resort() starts, every pair not owned by an active chunk is in
+// order. A chunk becomes idle only after a scan that swapped nothing
+// and during which no element of [stv, env] was changed by somebody
+// else: then all its pairs are in order, and stay so until one of its
+// elements changes, which activates it again. Thus when every chunk
+// is idle the vector is sorted.
+//
+
+struct resort_stats {
+  long activated = 0;  // chunks activated by the pending positions
+  long scans = 0;
+  long swaps = 0;
+};
+
+template<typename T>
+class sorted_vector {
+  enum state { IDLE, QUEUED, RUNNING, RUNNING_AGAIN };
+
+  struct alignas(64) chunk {
+    std::mutex mtx;  // protects v[stv], shared with the left neighbour
+    state st = IDLE;
+  };
+
+  std::vector<T> v;
+  const size_t chunk_len;
+  std::vector<size_t> stv, env;
+  std::vector<chunk> chunks;
+  // positions written since the last resort
+  std::vector<size_t> pending;
+
+  // the pool: mtx protects the queue, the chunk states and the counters
+  std::mutex mtx;
+  std::condition_variable cv_work, cv_idle;
+  std::deque<int> queue;
+  int active = 0;  // chunks not idle
+  bool shutdown = false;
+  resort_stats stats;
+  std::vector<std::thread> pool;
+
+  void partition() {
+    const size_t n = v.size();
+    const size_t nc = std::max<size_t>(1, n / chunk_len);
+    stv.clear();
+    env.clear();
+    for (size_t c = 0; c < nc; ++c) {
+      stv.push_back(n * c / nc);
+      env.push_back(c + 1 < nc ? n * (c + 1) / nc : (n > 0 ? n - 1 : 0));
+    }
+    chunks = std::vector<chunk>(nc);
+  }
+
+  size_t chunk_of(size_t i) const {
+    return std::upper_bound(stv.begin(), stv.end(), i) - stv.begin() - 1;
+  }
+
+  // with mtx held
+  void activate(int c) {
+    switch (chunks[c].st) {
+    case IDLE:
+      chunks[c].st = QUEUED;
+      ++active;
+      queue.push_back(c);
+      cv_work.notify_one();
+      break;
+    case RUNNING:
+      chunks[c].st = RUNNING_AGAIN;
+      break;
+    default:
+      break;
+    }
+  }
+
+  void activate_locked(int c) {
+    std::lock_guard<std::mutex> lk(mtx);
+    activate(c);
+  }
+
+  bool transpose(size_t i) {
+    if (v[i + 1] < v[i]) {
+      std::swap(v[i + 1], v[i]);
+      return true;
+    }
+    return false;
+  }
+
+  // an odd and an even pass over chunk c, returns the swaps performed
+  long scan(int c) {
+    const size_t st = stv[c], en = env[c];
+    const int last = chunks.size() - 1;
+    long swaps = 0;
+    for (size_t j : {1, 0})
+      for (size_t i = st + ((st ^ j) & 1); i < en; i += 2) {
+        const bool left = i == st && c > 0;
+        const bool right = i == en - 1 && c < last;
+        if (!left && !right) {
+          swaps += transpose(i);
+          continue;
+        }
+        // a pair touching a shared element: take its lock (left one
+        // first if the chunk is a single pair) and wake the neighbour
+        // that shares it if it changes
+        if (left) chunks[c].mtx.lock();
+        if (right) chunks[c + 1].mtx.lock();
+        if (transpose(i)) {
+          ++swaps;
+          if (left) activate_locked(c - 1);
+          if (right) activate_locked(c + 1);
+        }
+        if (right) chunks[c + 1].mtx.unlock();
+        if (left) chunks[c].mtx.unlock();
+      }
+    return swaps;
+  }
+
+  void worker() {
+    std::unique_lock<std::mutex> lk(mtx);
+    while (true) {
+      cv_work.wait(lk, [&] { return shutdown || !queue.empty(); });
+      if (shutdown)
+        return;
+      int c = queue.front();
+      queue.pop_front();
+      chunks[c].st = RUNNING;
+      lk.unlock();
+      long swaps = scan(c);
+      lk.lock();
+      stats.scans++;
+      stats.swaps += swaps;
+      if (swaps > 0 || chunks[c].st == RUNNING_AGAIN) {
+        chunks[c].st = QUEUED;
+        queue.push_back(c);
+      }
+      else {
+        chunks[c].st = IDLE;
+        if (--active == 0)
+          cv_idle.notify_all();
+      }
+    }
+  }
+
+public:
+  // init needs not be sorted: sort it first
+  sorted_vector(std::vector<T> init, int nw, size_t chunk_len = 64)
+    : v(std::move(init)), chunk_len(std::max<size_t>(chunk_len, 4)) {
+    std::sort(v.begin(), v.end());
+    partition();
+    for (int i = 0; i < nw; ++i)
+      pool.emplace_back([this] { worker(); });
+  }
+
+  ~sorted_vector() {
+    {
+      std::lock_guard<std::mutex> lk(mtx);
+      shutdown = true;
+    }
+    cv_work.notify_all();
+    for (auto& t : pool)
+      t.join();
+  }
+
+  size_t size() const { return v.size(); }
+  const T& operator[](size_t i) const { return v[i]; }
+  const std::vector<T>& data() const { return v; }
+  // chunks are scanned only by resort(), v is sorted if nothing is pending
+  bool clean() const { return pending.empty(); }
+
+  void update(size_t i, const T& x) {
+    v[i] = x;
+    pending.push_back(i);
+  }
+
+  // xs are merged in at the position they would have if v were sorted,
+  // in one backward sweep moving each element of v at most once; the
+  // positions of the pending elements follow them, and the new elements
+  // are pending as well since v may not be sorted yet
+  void insert_batch(std::vector<T> xs) {
+    std::sort(xs.begin(), xs.end());
+    std::sort(pending.begin(), pending.end());
+    pending.erase(std::unique(pending.begin(), pending.end()), pending.end());
+    const long n = v.size(), k = xs.size();
+    v.resize(n + k);
+    std::vector<size_t> moved;
+    long i = n - 1, j = k - 1, out = n + k - 1, d = pending.size() - 1;
+    while (j >= 0) {
+      if (i >= 0 && xs[j] < v[i]) {
+        if (d >= 0 && (long) pending[d] == i) {
+          moved.push_back(out);
+          --d;
+        }
+        v[out--] = std::move(v[i--]);
+      }
+      else {
+        moved.push_back(out);
+        v[out--] = xs[j--];
+      }
+    }
+    // below out nothing moved
+    for (; d >= 0; --d)
+      moved.push_back(pending[d]);
+    pending.swap(moved);
+    partition();
+  }
+
+  // sort v again, activating only the chunks around pending positions
+  resort_stats resort() {
+    std::unique_lock<std::mutex> lk(mtx);
+    stats = resort_stats();
+    for (size_t p : pending) {
+      // p is in the pairs (p - 1, p) and (p, p + 1)
+      size_t c = chunk_of(p);
+      if (chunks[c].st == IDLE) stats.activated++;
+      activate(c);
+      if (p > 0 && p == stv[c]) {
+        if (chunks[c - 1].st == IDLE) stats.activated++;
+        activate(c - 1);
+      }
+    }
+    pending.clear();
+    cv_idle.wait(lk, [&] { return active == 0; });
+    return stats;
+  }
+};
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <algorithm>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+//
+// one odd-even pass over v[lo, hi): every pair (j, j + 1) with
+// lo <= j < j + 1 < hi and j == parity (mod 2) is put in order.
+// All of them return whether some pair was swapped.
+//
+
+// the plain loop used by the engines
+inline bool pass_scalar(int *v, long lo, long hi, int parity) {
+  bool swapped = false;
+  for (long j = lo + ((lo ^ parity) & 1); j + 1 < hi; j += 2)
+    if (v[j + 1] < v[j]) {
+      std::swap(v[j + 1], v[j]);
+      swapped = true;
+    }
+  return swapped;
+}
+
+// min/max instead of a branch, which random data mispredicts half the time
+inline bool pass_branchless(int *v, long lo, long hi, int parity) {
+  bool swapped = false;
+  for (long j = lo + ((lo ^ parity) & 1); j + 1 < hi; j += 2) {
+    int a = v[j], b = v[j + 1];
+    v[j] = std::min(a, b);
+    v[j + 1] = std::max(a, b);
+    swapped |= b < a;
+  }
+  return swapped;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// four pairs at a time: deinterleave the first and second elements
+// of the pairs, take min and max and interleave them back
+__attribute__((target("sse4.1")))
+inline bool pass_sse(int *v, long lo, long hi, int parity) {
+  long j = lo + ((lo ^ parity) & 1);
+  __m128i acc = _mm_setzero_si128();
+  for (; j + 8 <= hi; j += 8) {
+    __m128 a = _mm_castsi128_ps(_mm_loadu_si128((__m128i *) (v + j)));
+    __m128 b = _mm_castsi128_ps(_mm_loadu_si128((__m128i *) (v + j + 4)));
+    __m128i x = _mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+    __m128i y = _mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+    acc = _mm_or_si128(acc, _mm_cmpgt_epi32(x, y));
+    __m128i mn = _mm_min_epi32(x, y);
+    __m128i mx = _mm_max_epi32(x, y);
+    _mm_storeu_si128((__m128i *) (v + j), _mm_unpacklo_epi32(mn, mx));
+    _mm_storeu_si128((__m128i *) (v + j + 4), _mm_unpackhi_epi32(mn, mx));
+  }
+  bool swapped = _mm_movemask_epi8(acc) != 0;
+  return pass_branchless(v, j, hi, parity) || swapped;
+}
+#endif
+
+// the SIMD pass if the CPU has it, the branchless one otherwise
+inline bool pass_simd(int *v, long lo, long hi, int parity) {
+#if defined(__x86_64__) || defined(__i386__)
+  static const bool has_sse = __builtin_cpu_supports("sse4.1");
+  if (has_sse)
+    return pass_sse(v, lo, hi, parity);
+#endif
+  return pass_branchless(v, lo, hi, parity);
+}
+
+// the pass the engines call: overloaded for the element types that have
+// a kernel of their own (ints here, strkey.hpp and kvpair.hpp), the
+// plain loop for any other type
+template<typename T>
+inline bool oe_pass(T* v, long lo, long hi, int parity) {
+  bool swapped = false;
+  for (long j = lo + ((lo ^ parity) & 1); j + 1 < hi; j += 2)
+    if (v[j + 1] < v[j]) {
+      std::swap(v[j + 1], v[j]);
+      swapped = true;
+    }
+  return swapped;
+}
+
+inline bool oe_pass(int* v, long lo, long hi, int parity) {
+  return pass_simd(v, lo, hi, parity);
+}
@@ -0,0 +1,258 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <thread>
+#include <cstdint>
+#include <cstring>
+#include <climits>
+#include <algorithm>
+#include <type_traits>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#include "kernels.hpp"
+#include "fill.hpp"
+
+//
+// key-value pairs. With --kv the engines sort (32-bit key, 32-bit
+// payload) pairs packed into one 64-bit word, the key in the high half
+// with its sign bit flipped, so that comparing words as unsigned
+// integers compares keys first and payloads only between equal keys.
+// A compare-exchange is then one unsigned min and max, which moves key
+// and payload together: the passes below do four or eight pairs at a
+// time with AVX2 or AVX-512 and stay branch-free without them.
+// --kv=struct sorts the same pairs as a struct compared through
+// operator<, the baseline. Payloads wider than 4 bytes (--kv-payload)
+// are kept apart, structure of arrays: the words pack the key with the
+// row of its payload, which makes ties stable, and once the words are
+// sorted the rows are gathered in order.
+//
+
+enum kv_layout { KV_OFF, KV_PACKED, KV_STRUCT };
+
+struct kv_config {
+  kv_layout layout = KV_OFF;
+  int payload = 4;          // bytes of payload, more than 4 are kept in rows
+  std::vector<char> rows;   // the payloads, structure of arrays
+};
+
+inline kv_config& kv_cfg() {
+  static kv_config cfg;
+  return cfg;
+}
+
+inline bool kv_enabled() { return kv_cfg().layout != KV_OFF; }
+inline bool kv_wide() { return kv_cfg().payload > 4; }
+
+// the 32-bit payload of a key, so that a pair torn apart is detected
+inline uint32_t kv_mix(int key) { return (uint32_t) key * 2654435761u; }
+
+struct kv_pair {
+  uint64_t w;
+  kv_pair(int key = 0, uint32_t payload = 0)
+    : w((uint64_t) ((uint32_t) key ^ 0x80000000u) << 32 | payload) {}
+  int key() const { return (int) ((uint32_t) (w >> 32) ^ 0x80000000u); }
+  uint32_t payload() const { return (uint32_t) w; }
+  bool operator<(const kv_pair& o) const { return w < o.w; }
+  bool operator<=(const kv_pair& o) const { return w <= o.w; }
+};
+
+// the same pairs and the same order, through the members
+struct kv_struct {
+  int key_;
+  uint32_t payload_;
+  kv_struct(int key = 0, uint32_t payload = 0) : key_(key), payload_(payload) {}
+  int key() const { return key_; }
+  uint32_t payload() const { return payload_; }
+  bool operator<(const kv_struct& o) const {
+    return key_ < o.key_ || (key_ == o.key_ && payload_ < o.payload_);
+  }
+  bool operator<=(const kv_struct& o) const { return !(o < *this); }
+};
+
+template<typename T>
+struct is_kv : std::integral_constant<bool, std::is_same<T, kv_pair>::value ||
+                                              std::is_same<T, kv_struct>::value> {};
+
+// min/max on the words, the fallback
+inline bool pass_kv_branchless(kv_pair* v, long lo, long hi, int parity) {
+  bool swapped = false;
+  for (long j = lo + ((lo ^ parity) & 1); j + 1 < hi; j += 2) {
+    uint64_t a = v[j].w, b = v[j + 1].w;
+    v[j].w = std::min(a, b);
+    v[j + 1].w = std::max(a, b);
+    swapped |= b < a;
+  }
+  return swapped;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// four pairs at a time: within each 128-bit lane unpacklo and unpackhi
+// of two loads give the first and the second words of the same pairs,
+// and the same unpacks of min and max put them back in place. AVX2 has
+// no 64-bit min and max, nor an unsigned compare: the sign bit is
+// flipped for the compare, which selects the words with a blend
+__attribute__((target("avx2")))
+inline bool pass_kv_avx2(kv_pair* v, long lo, long hi, int parity) {
+  static_assert(sizeof(kv_pair) == 8, "pairs must be packed in 8 bytes");
+  const __m256i sign = _mm256_set1_epi64x(INT64_MIN);
+  long j = lo + ((lo ^ parity) & 1);
+  __m256i acc = _mm256_setzero_si256();
+  for (; j + 8 <= hi; j += 8) {
+    __m256i a = _mm256_loadu_si256((__m256i*) (v + j));
+    __m256i b = _mm256_loadu_si256((__m256i*) (v + j + 4));
+    __m256i x = _mm256_unpacklo_epi64(a, b);
+    __m256i y = _mm256_unpackhi_epi64(a, b);
+    __m256i gt = _mm256_cmpgt_epi64(_mm256_xor_si256(x, sign), _mm256_xor_si256(y, sign));
+    acc = _mm256_or_si256(acc, gt);
+    __m256i mn = _mm256_blendv_epi8(x, y, gt);
+    __m256i mx = _mm256_blendv_epi8(y, x, gt);
+    _mm256_storeu_si256((__m256i*) (v + j), _mm256_unpacklo_epi64(mn, mx));
+    _mm256_storeu_si256((__m256i*) (v + j + 4), _mm256_unpackhi_epi64(mn, mx));
+  }
+  bool swapped = !_mm256_testz_si256(acc, acc);
+  return pass_kv_branchless(v, j, hi, parity) || swapped;
+}
+
+// eight pairs at a time, the same unpacks on four 128-bit lanes
+__attribute__((target("avx512f")))
+inline bool pass_kv_avx512(kv_pair* v, long lo, long hi, int parity) {
+  long j = lo + ((lo ^ parity) & 1);
+  __mmask8 acc = 0;
+  for (; j + 16 <= hi; j += 16) {
+    __m512i a = _mm512_loadu_si512((void*) (v + j));
+    __m512i b = _mm512_loadu_si512((void*) (v + j + 8));
+    __m512i x = _mm512_unpacklo_epi64(a, b);
+    __m512i y = _mm512_unpackhi_epi64(a, b);
+    acc |= _mm512_cmpgt_epu64_mask(x, y);
+    __m512i mn = _mm512_min_epu64(x, y);
+    __m512i mx = _mm512_max_epu64(x, y);
+    _mm512_storeu_si512((void*) (v + j), _mm512_unpacklo_epi64(mn, mx));
+    _mm512_storeu_si512((void*) (v + j + 8), _mm512_unpackhi_epi64(mn, mx));
+  }
+  return pass_kv_branchless(v, j, hi, parity) || acc != 0;
+}
+#endif
+
+// packed pairs use the widest SIMD pass the CPU has
+inline bool oe_pass(kv_pair* v, long lo, long hi, int parity) {
+#if defined(__x86_64__) || defined(__i386__)
+  static const bool has_avx512 = __builtin_cpu_supports("avx512f");
+  static const bool has_avx2 = __builtin_cpu_supports("avx2");
+  if (has_avx512)
+    return pass_kv_avx512(v, lo, hi, parity);
+  if (has_avx2)
+    return pass_kv_avx2(v, lo, hi, parity);
+#endif
+  return pass_kv_branchless(v, lo, hi, parity);
+}
+
+// random keys; the payload is the row of the pair with wide payloads,
+// whose every int repeats the key, and kv_mix(key) otherwise
+template<typename T, typename A>
+typename std::enable_if<is_kv<T>::value>::type fill_random(std::vector<T, A>& v) {
+  kv_config& cfg = kv_cfg();
+  const size_t row = cfg.payload;
+  if (kv_wide())
+    cfg.rows.assign(v.size() * row, 0);
+  for (size_t i = 0; i < v.size(); ++i) {
+    int key = rand();
+    if (!kv_wide()) {
+      v[i] = T(key, kv_mix(key));
+      continue;
+    }
+    v[i] = T(key, i);
+    for (size_t b = 0; b + sizeof(int) <= row; b += sizeof(int))
+      std::memcpy(&cfg.rows[i * row + b], &key, sizeof(int));
+  }
+}
+
+// with wide payloads, row i becomes the row of v[i]: reads are random,
+// so they are prefetched a few rows ahead, writes are sequential
+template<typename V>
+void kv_finish(const V& v, int nw) {
+  if constexpr (is_kv<typename V::value_type>::value) {
+    if (!kv_wide())
+      return;
+    kv_config& cfg = kv_cfg();
+    const size_t row = cfg.payload, n = v.size(), ahead = 8;
+    std::vector<char> out(n * row);
+    std::vector<std::thread> tids;
+    for (int t = 0; t < nw; ++t)
+      tids.emplace_back([&](size_t lo, size_t hi) {
+          for (size_t i = lo; i < hi; ++i) {
+            if (i + ahead < hi)
+              __builtin_prefetch(&cfg.rows[v[i + ahead].payload() * row]);
+            std::memcpy(&out[i * row], &cfg.rows[v[i].payload() * row], row);
+          }
+        }, n * t / nw, n * (t + 1) / nw);
+    for (auto& t : tids)
+      t.join();
+    cfg.rows.swap(out);
+  }
+}
+
+// every pair of v kept its payload, true for other types
+template<typename V>
+bool kv_check(const V& v) {
+  if constexpr (is_kv<typename V::value_type>::value) {
+    const kv_config& cfg = kv_cfg();
+    const size_t row = cfg.payload;
+    for (size_t i = 0; i < v.size(); ++i) {
+      int key = v[i].key(), first, last;
+      if (!kv_wide()) {
+        if (v[i].payload() != kv_mix(key))
+          return false;
+        continue;
+      }
+      std::memcpy(&first, &cfg.rows[i * row], sizeof(int));
+      std::memcpy(&last, &cfg.rows[(i + 1) * row - sizeof(int)], sizeof(int));
+      if (first != key || last != key)
+        return false;
+    }
+  }
+  return true;
+}
+
+// strip --kv[=packed|struct] and --kv-payload=<bytes> from the command
+// line; returns false on a malformed option
+inline bool kv_args(int& argc, char* argv[]) {
+  kv_config& cfg = kv_cfg();
+  int k = 1;
+  for (int i = 1; i < argc; ++i) {
+    std::string a = argv[i];
+    if (a == "--kv" || a == "--kv=packed")
+      cfg.layout = KV_PACKED;
+    else if (a == "--kv=struct")
+      cfg.layout = KV_STRUCT;
+    else if (a.rfind("--kv-payload=", 0) == 0) {
+      cfg.payload = std::stoi(a.substr(13));
+      if (cfg.payload < 4 || cfg.payload % 4) {
+        std::cerr << "payloads must be a positive multiple of 4 bytes\n";
+        return false;
+      }
+    }
+    else if (a.rfind("--kv", 0) == 0) {
+      std::cerr << "unknown option " << a << '\n';
+      return false;
+    }
+    else
+      argv[k++] = argv[i];
+  }
+  argc = k;
+  if (kv_wide() && cfg.layout != KV_PACKED) {
+    std::cerr << "--kv-payload needs --kv=packed\n";
+    return false;
+  }
+  return true;
+}
+
+// to be appended to the log message of an experiment
+inline std::string kv_describe() {
+  const kv_config& cfg = kv_cfg();
+  if (!kv_enabled()) return "";
+  return std::string(" --kv=") + (cfg.layout == KV_PACKED ? "packed" : "struct") +
+    (kv_wide() ? " --kv-payload=" + std::to_string(cfg.payload) : "");
+}
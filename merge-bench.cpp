@@ -0,0 +1,124 @@
+/*
+ * Author: Lorenzo Beretta <lorenzo2beretta@gmail.com>
+ * Date:   June 2020
+ */
+/*
+Benchmark of the merge primitives of merge.hpp against std::merge.
+Two-way: two sorted halves of a random vector are merged by std::merge,
+by the branch-free loop of merge_seq and by nworkers threads splitting
+the output with merge_path. K-way: k sorted runs are merged by rounds
+of std::merge on pairs of runs, the baseline, which reads and writes
+the whole vector log k times, and by a loser tree in a single pass,
+with and without prefetching, sequentially and by nworkers threads
+splitting the output with kway_split.
+*/
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include "merge.hpp"
+#include "utimer.hpp"
+
+template <typename F>
+void bench(const std::string &name, F f, std::vector<int> &out,
+	   const std::vector<int> &expected) {
+    long us;
+    std::fill(out.begin(), out.end(), 0);
+    {
+	utimer timer(name, &us);
+	f();
+    }
+    std::cout << name << ": " << 1000.0 * us / out.size() << " nsec per element"
+	      << (out == expected ? "" : ", WRONG RESULT") << '\n';
+}
+
+// rounds of std::merge on pairs of neighbouring runs of src, whose
+// bounds are at, ping-ponging with tmp; the last round writes to out
+void merge_tree(std::vector<int> &src, std::vector<int> &tmp, std::vector<int> &out,
+		std::vector<size_t> at) {
+    std::vector<int> *s = &src, *d = &tmp;
+    do {
+	if (at.size() <= 3)
+	    d = &out;
+	std::vector<size_t> next;
+	size_t r = 0;
+	for (; r + 2 < at.size(); r += 2) {
+	    std::merge(s->begin() + at[r], s->begin() + at[r + 1],
+		       s->begin() + at[r + 1], s->begin() + at[r + 2], d->begin() + at[r]);
+	    next.push_back(at[r]);
+	}
+	// an odd run out is copied as it is
+	std::copy(s->begin() + at[r], s->begin() + at.back(), d->begin() + at[r]);
+	next.push_back(at[r]);
+	if (next.back() != at.back())
+	    next.push_back(at.back());
+	at.swap(next);
+	std::swap(s, d);
+    } while (at.size() > 2);
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 4) {
+	std::cerr << "use: " << argv[0]  << " nworkers vector-length seed [k]\n";
+	return -1;
+    }
+
+    const int nw = std::stol(argv[1]);
+    const size_t n = std::stol(argv[2]);
+    const int seed = std::stol(argv[3]);
+    const int k = argc > 4 ? std::stol(argv[4]) : 16;
+    if (nw < 1 || k < 1) {
+	std::cerr << "nworkers and k must be positive\n";
+	return -1;
+    }
+
+    srand(seed);
+    std::vector<int> v(n);
+    for (auto &x : v) x = rand();
+    std::vector<int> expected(v);
+    std::sort(expected.begin(), expected.end());
+    std::vector<int> out(n);
+
+    // two-way
+    std::vector<int> a(v.begin(), v.begin() + n / 2), b(v.begin() + n / 2, v.end());
+    std::sort(a.begin(), a.end());
+    std::sort(b.begin(), b.end());
+    bench("std::merge", [&]() {
+	std::merge(a.begin(), a.end(), b.begin(), b.end(), out.begin());
+    }, out, expected);
+    bench("merge_seq", [&]() {
+	merge_seq(a.data(), a.size(), b.data(), b.size(), out.data());
+    }, out, expected);
+    bench("merge_par " + std::to_string(nw), [&]() {
+	merge_par(a.data(), a.size(), b.data(), b.size(), out.data(), nw);
+    }, out, expected);
+
+    // k-way, runs as even as the blocks of the other engines
+    std::vector<size_t> at;
+    std::vector<sorted_run<int>> runs;
+    std::vector<int> sorted(v);
+    for (int r = 0; r <= k; ++r)
+	at.push_back(n * r / k);
+    for (int r = 0; r < k; ++r) {
+	std::sort(sorted.begin() + at[r], sorted.begin() + at[r + 1]);
+	runs.push_back({sorted.data() + at[r], sorted.data() + at[r + 1]});
+    }
+    const std::string runs_name = " " + std::to_string(k) + " runs";
+    {
+	std::vector<int> src(sorted), tmp(n);
+	bench("std::merge tree" + runs_name, [&]() {
+	    merge_tree(src, tmp, out, at);
+	}, out, expected);
+    }
+    bench("loser tree" + runs_name, [&]() {
+	kway_merge(runs, out.data());
+    }, out, expected);
+    bench("loser tree no prefetch" + runs_name, [&]() {
+	kway_merge<int, false>(runs, out.data());
+    }, out, expected);
+    bench("loser tree par " + std::to_string(nw) + runs_name, [&]() {
+	kway_merge_par(runs, out.data(), nw);
+    }, out, expected);
+    return 0;
+}
@@ -0,0 +1,253 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <cstddef>
+#include <limits>
+#include <type_traits>
+#include <algorithm>
+
+//
+// merging sorted sequences. Everything here is stable, ties go to the
+// first sequence (to the run of lowest index in a k-way merge), as in
+// std::merge, and needs only operator< on the elements.
+//   merge_path   the split of the first d elements of the merge of a
+//                and b between a and b, by a binary search along the
+//                d-th cross diagonal of the merge matrix (Odeh et al.)
+//   merge_range  elements [lo, hi) of the merge alone, so that nw
+//                workers merge n / nw elements each whatever the data
+//   loser_tree   k-way merge: each element costs log k comparisons
+//                against the losers on the way from its leaf to the
+//                root, and the run it came from is prefetched ahead
+//   kway_split   the split of the first r elements of a k-way merge
+//                among the runs, by a binary search on all the runs at
+//                once, which makes the k-way merge parallel the same
+//                way merge_path does for two sequences
+//
+
+// elements prefetched ahead in each run of a k-way merge, 4 cache lines
+const size_t MERGE_AHEAD = 256;
+
+// the number of elements of a among the first d of the merge of a and b
+template<typename T>
+size_t merge_path(const T* a, size_t na, const T* b, size_t nb, size_t d) {
+  size_t lo = d > nb ? d - nb : 0, hi = std::min(d, na);
+  while (lo < hi) {
+    size_t i = lo + (hi - lo) / 2;
+    // a[i] is taken before b[d - i - 1] unless it is greater
+    if (b[d - i - 1] < a[i])
+      hi = i;
+    else
+      lo = i + 1;
+  }
+  return lo;
+}
+
+// the merge loop, without branches on the data for scalar types
+template<typename T>
+void merge_seq(const T* a, size_t na, const T* b, size_t nb, T* out) {
+  size_t i = 0, j = 0, k = 0;
+  while (i < na && j < nb) {
+    const bool tb = b[j] < a[i];
+    out[k++] = tb ? b[j] : a[i];
+    j += tb;
+    i += !tb;
+  }
+  out = std::copy(a + i, a + na, out + k);
+  std::copy(b + j, b + nb, out);
+}
+
+// write elements [lo, hi) of the merge of a and b to out[0, hi - lo)
+template<typename T>
+void merge_range(const T* a, size_t na, const T* b, size_t nb, T* out, size_t lo, size_t hi) {
+  const size_t i = merge_path(a, na, b, nb, lo), ie = merge_path(a, na, b, nb, hi);
+  merge_seq(a + i, ie - i, b + lo - i, hi - ie - (lo - i), out);
+}
+
+// merge a and b into out with nw threads, each writing n / nw elements
+template<typename T>
+void merge_par(const T* a, size_t na, const T* b, size_t nb, T* out, int nw) {
+  const size_t n = na + nb;
+  std::vector<std::thread> tids;
+  for (int t = 1; t < nw; ++t)
+    tids.emplace_back([=]() {
+        const size_t lo = n * t / nw, hi = n * (t + 1) / nw;
+        merge_range(a, na, b, nb, out + lo, lo, hi);
+      });
+  merge_range(a, na, b, nb, out, 0, n / nw);
+  for (auto& t : tids)
+    t.join();
+}
+
+// a sorted run [first, last) of a k-way merge
+template<typename T>
+struct sorted_run {
+  const T* first;
+  const T* last;
+  size_t size() const { return last - first; }
+};
+
+template<typename T, bool PREFETCH = true>
+class loser_tree
+{
+private:
+  // a node keeps the head of its run next to the run, so that a match
+  // reads no run; runs that are exhausted are moved to src + k and lose.
+  // Integers give them their largest value too, and then they lose on
+  // src alone, since no key is greater; floating point keys may be (an
+  // infinity, a NaN), so they and other types are matched on src first
+  static const bool SENTINEL = std::is_integral<T>::value;
+  struct node {
+    T   key;
+    int src;
+  };
+  int                   d_k;
+  int                   d_leaves;    // k rounded up to a power of two
+  std::vector<const T*> d_cur;       // the next element of each run
+  std::vector<const T*> d_end;
+  std::vector<node>     d_loser;     // d_loser[0] is the winner
+
+  // x wins against y, ties go to the lower run; the matches are played
+  // with bitwise operators, the outcome of a match is a coin toss on
+  // random data and a branch on it would mispredict half of the time
+  bool beats(const node& x, const node& y) const {
+    const bool wins = (x.key < y.key) | (!(y.key < x.key) & (x.src < y.src));
+    if (SENTINEL)
+      return wins;
+    const bool xd = x.src >= this->d_k, yd = y.src >= this->d_k;
+    return yd | ((!xd) & wins);
+  }
+
+  node head(int i) {
+    if (this->d_cur[i] == this->d_end[i])
+      return node{SENTINEL ? std::numeric_limits<T>::max() : T(), i + this->d_k};
+    return node{*this->d_cur[i]++, i};
+  }
+
+public:
+
+  loser_tree(const std::vector<sorted_run<T>>& runs) {
+    this->d_k = runs.size();
+    this->d_leaves = 1;
+    while (this->d_leaves < this->d_k) this->d_leaves <<= 1;
+    this->d_cur.assign(this->d_leaves, nullptr);
+    this->d_end.assign(this->d_leaves, nullptr);
+    for (int i = 0; i < this->d_k; ++i) {
+      this->d_cur[i] = runs[i].first;
+      this->d_end[i] = runs[i].last;
+    }
+    // play the tournament bottom-up, winners go up, losers stay
+    std::vector<node> win(2 * this->d_leaves);
+    this->d_loser.resize(this->d_leaves);
+    for (int i = 0; i < this->d_leaves; ++i)
+      win[this->d_leaves + i] = head(i);
+    for (int n = this->d_leaves - 1; n >= 1; --n) {
+      bool lw = beats(win[2 * n], win[2 * n + 1]);
+      win[n] = win[2 * n + !lw];
+      this->d_loser[n] = win[2 * n + lw];
+    }
+    this->d_loser[0] = win[1];
+  }
+
+  bool empty() const { return this->d_loser[0].src >= this->d_k; }
+
+  const T& top() const { return this->d_loser[0].key; }
+
+  // replace the winner with the next element of its run and replay its
+  // matches up to the root
+  void pop() {
+    const int i = this->d_loser[0].src;
+    node w = head(i);
+    if (PREFETCH && (size_t) (this->d_end[i] - this->d_cur[i]) > MERGE_AHEAD)
+      __builtin_prefetch(this->d_cur[i] + MERGE_AHEAD);
+    for (int n = (this->d_leaves + i) / 2; n >= 1; n /= 2) {
+      const node c[2] = {this->d_loser[n], w};
+      const bool lw = beats(c[0], w);
+      this->d_loser[n] = c[lw];
+      w = c[!lw];
+    }
+    this->d_loser[0] = w;
+  }
+};
+
+// merge the runs into out
+template<typename T, bool PREFETCH = true>
+void kway_merge(const std::vector<sorted_run<T>>& runs, T* out) {
+  if (runs.size() == 1) {
+    std::copy(runs[0].first, runs[0].last, out);
+    return;
+  }
+  loser_tree<T, PREFETCH> lt(runs);
+  for (; !lt.empty(); lt.pop())
+    *out++ = lt.top();
+}
+
+// pos[i] elements of run i are among the first r of the merge. pos[i]
+// is known to lie in [lo[i], hi[i]): the middle x of the widest range
+// is ranked in every range, and either all the splits fall before the
+// elements not less than x, or after those not greater, or x is the
+// r-th element and the elements equal to it are handed out in the
+// order of the runs. Every round halves the widest range at least
+template<typename T>
+void kway_split(const std::vector<sorted_run<T>>& runs, size_t r, size_t* pos) {
+  const size_t k = runs.size();
+  std::vector<size_t> lo(k, 0), hi(k), lb(k), ub(k);
+  for (size_t i = 0; i < k; ++i)
+    hi[i] = runs[i].size();
+  while (true) {
+    size_t w = 0;
+    for (size_t i = 1; i < k; ++i)
+      if (hi[i] - lo[i] > hi[w] - lo[w])
+        w = i;
+    if (k == 0 || lo[w] == hi[w])
+      break;
+    const T x = runs[w].first[lo[w] + (hi[w] - lo[w]) / 2];
+    size_t nlb = 0, nub = 0;
+    for (size_t i = 0; i < k; ++i) {
+      const T* f = runs[i].first;
+      lb[i] = std::lower_bound(f + lo[i], f + hi[i], x) - f;
+      ub[i] = std::upper_bound(f + lb[i], f + hi[i], x) - f;
+      nlb += lb[i];
+      nub += ub[i];
+    }
+    if (r <= nlb)
+      hi.swap(lb);
+    else if (r >= nub)
+      lo.swap(ub);
+    else {
+      size_t left = r - nlb;
+      for (size_t i = 0; i < k; ++i) {
+        size_t take = std::min(left, ub[i] - lb[i]);
+        lo[i] = lb[i] + take;
+        left -= take;
+      }
+      break;
+    }
+  }
+  std::copy(lo.begin(), lo.end(), pos);
+}
+
+// merge the runs into out with nw threads, each splitting its share of
+// the output among the runs and merging it with a loser tree of its own
+template<typename T, bool PREFETCH = true>
+void kway_merge_par(const std::vector<sorted_run<T>>& runs, T* out, int nw) {
+  size_t n = 0;
+  for (const auto& s : runs)
+    n += s.size();
+  auto body = [&](int t) {
+    const size_t lo = n * t / nw, hi = n * (t + 1) / nw;
+    std::vector<size_t> from(runs.size()), to(runs.size());
+    kway_split(runs, lo, from.data());
+    kway_split(runs, hi, to.data());
+    std::vector<sorted_run<T>> mine(runs.size());
+    for (size_t i = 0; i < runs.size(); ++i)
+      mine[i] = {runs[i].first + from[i], runs[i].first + to[i]};
+    kway_merge<T, PREFETCH>(mine, out + lo);
+  };
+  std::vector<std::thread> tids;
+  for (int t = 1; t < nw; ++t)
+    tids.emplace_back(body, t);
+  body(0);
+  for (auto& t : tids)
+    t.join();
+}
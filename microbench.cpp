@@ -0,0 +1,327 @@
+/* 
+ * Author: Lorenzo Beretta <lorenzo2beretta@gmail.com> 
+ * Date:   June 2020
+ */
+/*
+Microbenchmarks of the primitives the engines are made of, so that a
+regression of a whole-program timing can be pinned on one of them:
+- one odd-even pass over L1, L2, L3 and DRAM sized spans (kernels.hpp),
+  and over key-value pairs packed in words or held in structs (kvpair.hpp),
+- many tiny arrays sorted by loops, by unrolled networks and by networks
+  running one array per SIMD lane (network.hpp),
+- barrier episode latency vs number of threads and wait policy (wait.hpp),
+  for barrier.hpp's barrier and for the handoff through the main thread
+  that pthread-barrier.cpp runs its passes with,
+- syque push/pop throughput,
+- mutex handoff, the mtx_block pattern of pthread-async.cpp,
+- FastFlow farm round trip (only if FastFlow is available).
+Every figure is the median of several repetitions, reported with the
+minimum and the standard deviation; the main thread is pinned and the
+CPU is kept busy for a while first, so that its frequency settles.
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <sched.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#if __has_include(<ff/farm.hpp>)
+#define HAS_FASTFLOW
+#include <ff/ff.hpp>
+#include <ff/farm.hpp>
+#endif
+#include "syque.hpp"
+#include "ringq.hpp"
+#include "barrier.hpp"
+#include "kernels.hpp"
+#include "network.hpp"
+#include "kvpair.hpp"
+
+using hrc = std::chrono::steady_clock;
+
+double elapsed_ns(hrc::time_point start) {
+    return std::chrono::duration<double, std::nano>(hrc::now() - start).count();
+}
+
+// run f reps times, f returns the nanoseconds per operation
+template<typename F>
+void measure(const std::string &name, int reps, F f) {
+    f();  // warm up caches and code
+    std::vector<double> s(reps);
+    for (auto &x : s) x = f();
+    std::sort(s.begin(), s.end());
+    double mean = 0, var = 0;
+    for (auto x : s) mean += x / reps;
+    for (auto x : s) var += (x - mean) * (x - mean) / reps;
+    std::cout << std::left << std::setw(40) << name << std::right << std::fixed;
+    std::cout << std::setprecision(3) << std::setw(14) << s[reps / 2] << " ns  (min ";
+    std::cout << s[0] << ", stddev " << std::sqrt(var) << ")" << std::endl;
+}
+
+// sense reversing barrier, spinning on an atomic (and yielding now
+// and then, so that it survives more threads than cores)
+class spin_barrier {
+    const int nthreads;
+    std::atomic<int> count;
+    std::atomic<int> sense{0};
+public:
+    spin_barrier(int n): nthreads(n), count(n) {}
+    void wait() {
+	int s = sense.load();
+	if (count.fetch_sub(1) == 1) {
+	    count.store(nthreads);
+	    sense.store(1 - s);
+	    return;
+	}
+	for (int i = 1; sense.load() == s; ++i)
+	    if (i % WAIT_POLLS) cpu_relax();
+	    else std::this_thread::yield();
+    }
+};
+
+// average duration of an episode of a barrier shared by nt threads,
+// built with the extra arguments a
+template<typename B, typename... A>
+double barrier_episode(int nt, int episodes, A... a) {
+    B bar(nt, a...);
+    std::vector<std::thread> tids;
+    auto start = hrc::now();
+    for (int t = 0; t < nt; ++t)
+	tids.emplace_back([&]() { for (int e = 0; e < episodes; ++e) bar.wait(); });
+    for (auto &t : tids) t.join();
+    return elapsed_ns(start) / episodes;
+}
+
+// average duration of a round of the handoff of pthread-barrier.cpp,
+// the main thread starting it and waiting for the nt workers to end it
+double handoff_episode(int nt, int episodes, wait_policy p) {
+    handoff h(nt, p);
+    std::vector<std::thread> tids;
+    auto start = hrc::now();
+    for (int t = 0; t < nt; ++t)
+	tids.emplace_back([&]() { int seen = 0; while (h.next(seen)) h.end(); });
+    for (int e = 0; e < episodes; ++e) {
+	h.start();
+	h.finish();
+    }
+    h.stop();
+    for (auto &t : tids) t.join();
+    return elapsed_ns(start) / episodes;
+}
+
+// average time for a mutex to go from a thread to the other one
+double mutex_handoff(int handoffs) {
+    std::mutex mtx;
+    int turn = 0;
+    auto body = [&](int me) {
+		    for (int done = 0; done < handoffs / 2; ) {
+			bool mine;
+			{
+			    std::lock_guard<std::mutex> lk(mtx);
+			    mine = (turn == me);
+			    if (mine) {
+				turn = 1 - me;
+				++done;
+			    }
+			}
+			if (!mine) std::this_thread::yield();
+		    }
+		};
+    auto start = hrc::now();
+    std::thread a(body, 0), b(body, 1);
+    a.join();
+    b.join();
+    return elapsed_ns(start) / handoffs;
+}
+
+template<typename Q>
+double queue_item(Q &q, int items) {
+    auto start = hrc::now();
+    std::thread prod([&]() { for (int i = 0; i < items; ++i) q.push(i); });
+    for (int i = 0; i < items; ++i) q.pop();
+    prod.join();
+    return elapsed_ns(start) / items;
+}
+
+// sort windows of N ints in the ways network.hpp competes with
+template<int N>
+void bench_windows(int reps) {
+    const long count = (1 << 22) / N;
+    std::vector<int> v(count * N);
+    auto window = [&](const std::string &how, auto sort) {
+	measure("window " + std::to_string(N) + " " + how + " /window", reps, [&]() {
+	    for (auto &z : v) z = rand();
+	    auto start = hrc::now();
+	    sort();
+	    double ns = elapsed_ns(start) / count;
+	    for (long w = 0; w < count; ++w)
+		if (!std::is_sorted(v.begin() + w * N, v.begin() + (w + 1) * N))
+		    std::cerr << "window " << w << " IS NOT SORTED!\n";
+	    return ns;
+	});
+    };
+    window("std::sort", [&]() {
+	for (long w = 0; w < count; ++w) std::sort(&v[w * N], &v[(w + 1) * N]);
+    });
+    // the loop of oesort_seq, stopping after a clean round
+    window("oesort loop", [&]() {
+	for (long w = 0; w < count; ++w)
+	    while (pass_branchless(&v[w * N], 0, N, 1) | pass_branchless(&v[w * N], 0, N, 0));
+    });
+    window("transposition net", [&]() {
+	for (long w = 0; w < count; ++w) sort_fixed<N>(&v[w * N]);
+    });
+    window("batcher net", [&]() {
+	for (long w = 0; w < count; ++w) sort_fixed<N, BATCHER>(&v[w * N]);
+    });
+    window("transposition lanes", [&]() { sort_windows<N>(v.data(), count); });
+    window("batcher lanes", [&]() { sort_windows<N, BATCHER>(v.data(), count); });
+}
+
+// npass odd-even passes over n pairs of T, from random pairs
+template<typename T>
+void bench_kv_pass(const std::string &name, int reps, long n, int npass) {
+    std::vector<T> v(n);
+    measure(name, reps, [&]() {
+	fill_random(v);
+	auto start = hrc::now();
+	for (int p = 0; p < npass; ++p) oe_pass(v.data(), 0, n, p & 1);
+	return elapsed_ns(start) / npass / n;
+    });
+}
+
+#ifdef HAS_FASTFLOW
+using namespace ff;
+#undef EOS  // the one of syque.hpp would hide ff_node_t::EOS
+
+struct rt_emitter: ff_node_t<long> {
+    long left;
+    rt_emitter(long n): left(n) {}
+    long* svc(long* it) {
+	if (left-- == 0) return EOS;
+	return (long*) 1;  // any non-null pointer is a task
+    }
+};
+
+struct rt_worker: ff_node_t<long> {
+    long* svc(long* it) { return it; }
+};
+
+double farm_round_trip(int trips) {
+    std::vector<std::unique_ptr<ff_node>> w;
+    w.push_back(std::make_unique<rt_worker>());
+    ff_Farm<long> farm(std::move(w));
+    rt_emitter em(trips);
+    farm.add_emitter(em);
+    farm.remove_collector();
+    farm.wrap_around();
+    auto start = hrc::now();
+    if (farm.run_and_wait_end() < 0) error("running farm");
+    return elapsed_ns(start) / trips;
+}
+#endif
+
+int main(int argc, char* argv[]) {
+    if (argc > 1 && std::string(argv[1]) == "-h") {
+	std::cerr << "use: " << argv[0] << " [repetitions] [max-threads]\n";
+	return -1;
+    }
+    const int reps = (argc > 1) ? std::stol(argv[1]) : 11;
+    const int maxt = (argc > 2) ? std::stol(argv[2]) : std::thread::hardware_concurrency();
+
+    // pin the main thread and let the CPU frequency settle
+    cpu_set_t all, set;
+    sched_getaffinity(0, sizeof(all), &all);
+    CPU_ZERO(&set);
+    CPU_SET(0, &set);
+    sched_setaffinity(0, sizeof(set), &set);
+    active_delay(200);
+
+    // ---------------------------- PASS KERNELS ---------------------------
+    typedef bool (*kernel)(int *, long, long, int);
+    const std::pair<std::string, kernel> kernels[] = {
+	{"scalar", pass_scalar}, {"branchless", pass_branchless}, {"simd", pass_simd}};
+    const std::pair<std::string, long> spans[] = {
+	{"L1 (16KB)", 16 << 10}, {"L2 (256KB)", 256 << 10},
+	{"L3 (8MB)", 8 << 20}, {"DRAM (256MB)", 256 << 20}};
+    for (auto &sp : spans) {
+	const long n = sp.second / sizeof(int);
+	std::vector<int> v(n);
+	// enough passes to visit about 2^26 elements
+	const int npass = std::max(2L, (1L << 26) / n);
+	for (auto &k : kernels)
+	    measure("pass " + k.first + " " + sp.first + " /elem", reps, [&]() {
+		for (auto &z : v) z = rand();
+		auto start = hrc::now();
+		for (int p = 0; p < npass; ++p) k.second(v.data(), 0, n, p & 1);
+		return elapsed_ns(start) / npass / n;
+	    });
+    }
+
+    // key-value pairs: the packed words take the SIMD pass, the structs
+    // the plain loop through operator<
+    for (auto &sp : spans) {
+	const long n = sp.second / sizeof(kv_pair);
+	const int npass = std::max(2L, (1L << 26) / n);
+	bench_kv_pass<kv_pair>("pass kv packed " + sp.first + " /pair", reps, n, npass);
+	bench_kv_pass<kv_struct>("pass kv struct " + sp.first + " /pair", reps, n, npass);
+    }
+
+    // ---------------------------- SORTING NETWORKS -----------------------
+    bench_windows<4>(reps);
+    bench_windows<8>(reps);
+    bench_windows<16>(reps);
+    bench_windows<32>(reps);
+    bench_windows<64>(reps);
+
+    // threads inherit the affinity, give them every CPU back
+    sched_setaffinity(0, sizeof(all), &all);
+
+    // ---------------------------- BARRIERS -------------------------------
+    const int episodes = 10000;
+    for (int nt = 1; nt <= maxt; nt *= 2) {
+	std::string t = " " + std::to_string(nt) + " threads /episode";
+	for (wait_policy p : {WAIT_BLOCK, WAIT_FUTEX, WAIT_YIELD, WAIT_SPIN})
+	    measure(std::string("barrier ") + wait_name(p) + t, reps,
+		    [&]() { return barrier_episode<barrier>(nt, episodes, p); });
+	for (wait_policy p : {WAIT_BLOCK, WAIT_FUTEX, WAIT_YIELD, WAIT_SPIN})
+	    measure(std::string("handoff ") + wait_name(p) + t, reps,
+		    [&]() { return handoff_episode(nt, episodes, p); });
+	measure("spin barrier" + t, reps, [&]() { return barrier_episode<spin_barrier>(nt, episodes); });
+#ifdef _OPENMP
+	measure("omp barrier" + t, reps, [&]() {
+	    auto start = hrc::now();
+#pragma omp parallel num_threads(nt)
+	    for (int e = 0; e < episodes; ++e) {
+#pragma omp barrier
+	    }
+	    return elapsed_ns(start) / episodes;
+	});
+#endif
+    }
+
+    // ---------------------------- QUEUES AND LOCKS -----------------------
+    const int items = 100000;
+    measure("syque push/pop /item", reps, [&]() {
+	syque<int> q;
+	return queue_item(q, items);
+    });
+    measure("mpmc_ring push/pop /item", reps, [&]() {
+	mpmc_ring<int> q(1024);
+	return queue_item(q, items);
+    });
+    measure("mutex handoff /handoff", reps, [&]() { return mutex_handoff(items); });
+#ifdef HAS_FASTFLOW
+    measure("farm round trip /trip", reps, [&]() { return farm_round_trip(items); });
+#endif
+    return 0;
+}
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <array>
+#include <utility>
+#include <cstddef>
+#include <algorithm>
+
+//
+// sorting networks for tiny fixed sizes. The compare-exchange schedule
+// of sort_fixed<N> is computed at compile time and unrolled, so that no
+// loop control and no branch is left, only min and max:
+//   TRANSPOSITION  N passes of odd-even transposition sort, the odd
+//                  one first as in oesort_seq: N^2/2 comparators
+//   BATCHER        Batcher's odd-even merge sort on the next power of
+//                  two, without the comparators beyond N (they would
+//                  only see +infinity): O(N log^2 N) comparators
+// sort_fixed_lanes<N, L> runs the same schedule on L arrays at once,
+// interleaved so that element i of array l is v[i * L + l]: each
+// compare-exchange is then a vector min and max over L lanes.
+// sort_windows<N> sorts many consecutive arrays of N ints, L = 16 or 8
+// at a time with AVX-512 or AVX2, interleaving them in a small buffer.
+//
+
+enum network_kind { TRANSPOSITION, BATCHER };
+
+struct comparator {
+  int a, b;
+};
+
+// comparators of a network of kind K on N elements, in order; with
+// out == nullptr they are only counted
+template<network_kind K>
+constexpr int build_network(int N, comparator* out) {
+  int c = 0;
+  if (K == TRANSPOSITION) {
+    for (int p = 0; p < N; ++p)
+      for (int j = (p & 1) ? 0 : 1; j + 1 < N; j += 2) {
+        if (out) out[c] = {j, j + 1};
+        ++c;
+      }
+    return c;
+  }
+  int P = 1;
+  while (P < N) P <<= 1;
+  for (int p = 1; p < P; p <<= 1)
+    for (int k = p; k >= 1; k >>= 1)
+      for (int j = k % p; j + k < P; j += 2 * k)
+        for (int i = 0; i < k && i + j + k < P; ++i)
+          if ((i + j) / (2 * p) == (i + j + k) / (2 * p) && i + j + k < N) {
+            if (out) out[c] = {i + j, i + j + k};
+            ++c;
+          }
+  return c;
+}
+
+template<int N, network_kind K>
+struct network {
+  static constexpr int size = build_network<K>(N, nullptr);
+  static constexpr std::array<comparator, size> schedule() {
+    std::array<comparator, size> s{};
+    build_network<K>(N, s.data());
+    return s;
+  }
+  static constexpr std::array<comparator, size> comparators = schedule();
+};
+
+// works on scalars and on GCC vector types alike
+template<typename T>
+__attribute__((always_inline)) inline void compare_exchange(T& x, T& y) {
+  T lo = x < y ? x : y;
+  T hi = x < y ? y : x;
+  x = lo;
+  y = hi;
+}
+
+template<int N, network_kind K, typename T, size_t... I>
+__attribute__((always_inline)) inline void apply_network(T* v, std::index_sequence<I...>) {
+  constexpr auto& s = network<N, K>::comparators;
+  (compare_exchange(v[s[I].a], v[s[I].b]), ...);
+}
+
+template<int N, network_kind K = TRANSPOSITION, typename T>
+__attribute__((always_inline)) inline void sort_fixed(T* v) {
+  apply_network<N, K>(v, std::make_index_sequence<network<N, K>::size>());
+}
+
+typedef int lanes8 __attribute__((vector_size(32)));
+typedef int lanes16 __attribute__((vector_size(64)));
+
+template<int L> struct lane_vector;
+template<> struct lane_vector<8> { typedef lanes8 type; };
+template<> struct lane_vector<16> { typedef lanes16 type; };
+
+// v holds L interleaved arrays of N ints, element i of array l is v[i * L + l]
+template<int N, int L, network_kind K = TRANSPOSITION>
+__attribute__((always_inline)) inline void sort_fixed_lanes(int* v) {
+  typedef typename lane_vector<L>::type vec;
+  vec r[N];
+  for (int i = 0; i < N; ++i)
+    __builtin_memcpy(&r[i], v + i * L, sizeof(vec));
+  sort_fixed<N, K>(r);
+  for (int i = 0; i < N; ++i)
+    __builtin_memcpy(v + i * L, &r[i], sizeof(vec));
+}
+
+// sort the groups of L consecutive arrays of N ints starting at v
+template<int N, int L, network_kind K>
+__attribute__((always_inline)) inline void windows_lanes(int* v, size_t groups) {
+  alignas(64) int buf[N * L];
+  for (size_t g = 0; g < groups; ++g, v += N * L) {
+    for (int l = 0; l < L; ++l)
+      for (int i = 0; i < N; ++i)
+        buf[i * L + l] = v[l * N + i];
+    sort_fixed_lanes<N, L, K>(buf);
+    for (int l = 0; l < L; ++l)
+      for (int i = 0; i < N; ++i)
+        v[l * N + i] = buf[i * L + l];
+  }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+template<int N, network_kind K>
+__attribute__((target("avx2"))) void windows_avx2(int* v, size_t groups) {
+  windows_lanes<N, 8, K>(v, groups);
+}
+
+template<int N, network_kind K>
+__attribute__((target("avx512f"))) void windows_avx512(int* v, size_t groups) {
+  windows_lanes<N, 16, K>(v, groups);
+}
+#endif
+
+// sort count consecutive arrays of N ints, v[w * N, (w + 1) * N) for
+// each w < count, as many at a time as the CPU has lanes
+template<int N, network_kind K = TRANSPOSITION>
+void sort_windows(int* v, size_t count) {
+  size_t done = 0;
+#if defined(__x86_64__) || defined(__i386__)
+  static const bool has_avx512 = __builtin_cpu_supports("avx512f");
+  static const bool has_avx2 = __builtin_cpu_supports("avx2");
+  if (has_avx512) {
+    windows_avx512<N, K>(v, count / 16);
+    done = count / 16 * 16;
+  }
+  else if (has_avx2) {
+    windows_avx2<N, K>(v, count / 8);
+    done = count / 8 * 8;
+  }
+#endif
+  for (size_t w = done; w < count; ++w)
+    sort_fixed<N, K>(v + w * N);
+}
@@ -8,21 +8,29 @@
 #include <algorithm>
 #include <cassert>
 #include <omp.h>
+#include "cmpcost.hpp"
+#include "roofline.hpp"
 #include "utimer.hpp"
 
+// both versions return the memory traffic of the passes
 template<typename T>
-void oesort_omp(std::vector<T> &v, int nworkers) {
+traffic oesort_omp(std::vector<T> &v, int nworkers) {
     size_t n = v.size();
     bool sorted = false;
+    traffic t;
     
 #pragma omp parallel num_threads(nworkers)
     while (!sorted) {
 	
-#pragma omp single
-	sorted = true;
-	
+	// every thread must have read sorted before it is reset
 #pragma omp barrier  // a lot of overhead is introduced here...
 	
+#pragma omp single
+	{
+	    sorted = true;
+	    t.pass(n, sizeof(T), 2);
+	}
+	
 #pragma omp for  // odd phase
 	for (int i = 1; i < n - 1; i += 2) {
 	    if (v[i + 1] < v[i]) {
@@ -39,30 +47,155 @@ void oesort_omp(std::vector<T> &v, int nworkers) {
 	    }
 	}
     }
+    return t;
+}
+
+// This version replaces the global barriers of oesort_omp with a dataflow
+// graph: one task per (block, pass), whose depend clauses let the runtime
+// enforce the same neighbour rule that masterStage enforces by hand in
+// ff-farm.cpp. Task (i, p) reads the sentinels written by (i - 1, p - 1),
+// (i, p - 1) and (i + 1, p - 1) and writes its own one, so concurrently
+// running neighbours are always in the same pass and the transpositions
+// are exactly the ones of oesort_seq.
+// Sentinels are duplicated by parity, otherwise every task of a pass
+// would depend on its left neighbour in the same pass.
+// Passes are spawned in rounds of PASSES_PER_ROUND inside a taskgroup,
+// which is cancelled as soon as two consecutive passes are clean
+// (cancellation requires OMP_CANCELLATION=true, without it the round
+// is completed and the check is performed at its end).
+const int PASSES_PER_ROUND = 32;
+
+template<typename T>
+traffic oesort_omp_tasks(std::vector<T> &v, int nworkers, int nb) {
+    const int n = v.size();
+    traffic t;
+    if (n < 2) return t;
+    nb = std::max(1, std::min(nb, n / 2));
+    int delta = n / nb;
+    int reminder = n % nb;
+    // define block bundaries so that they are perfectly balanced
+    // (i.e. |env[i] - env[j] - stv[i] + stv[j]| <= 1 for each i and j) 
+    std::vector<int> stv, env;
+    for (int i = 0; i < n; i += delta) {
+	stv.push_back(i);
+	if (reminder-- > 0) i++;
+	env.push_back((i + delta < n) ? (i + delta) : (n - 1));
+    }
+    nb = stv.size();
+
+    std::vector<char> dep(2 * nb);
+    char *sentinel[2] = {dep.data(), dep.data() + nb};
+    // per pass of the current round: number of blocks done and
+    // whether any of them performed a swap
+    std::vector<int> finished(PASSES_PER_ROUND), dirty(PASSES_PER_ROUND);
+    bool last_clean = false;  // whether the last pass of the previous round was clean
+    bool sorted = false;
+
+#pragma omp parallel num_threads(nworkers)
+#pragma omp single
+    for (int p0 = 0; !sorted && p0 < n; p0 += PASSES_PER_ROUND) {
+	const int np = std::min(PASSES_PER_ROUND, n - p0);
+	std::fill(finished.begin(), finished.end(), 0);
+	std::fill(dirty.begin(), dirty.end(), 0);
+	
+#pragma omp taskgroup
+	for (int p = p0; p < p0 + np; ++p)
+	    for (int i = 0; i < nb; ++i) {
+		char *cur = sentinel[p & 1];
+		char *prv = sentinel[~p & 1];
+		int l = std::max(i - 1, 0);
+		int r = std::min(i + 1, nb - 1);
+		
+#pragma omp task depend(in: prv[l], prv[i], prv[r]) depend(inout: cur[i])
+		{
+#pragma omp cancellation point taskgroup
+		    const int k = p - p0;
+		    bool swapped = false;
+		    // odd phase first, as in oesort_seq
+		    for (int j = stv[i] + ((stv[i] & 1) ^ (~p & 1)); j < env[i]; j += 2)
+			if (v[j + 1] < v[j]) {
+			    std::swap(v[j + 1], v[j]);
+			    swapped = true;
+			}
+		    if (swapped) {
+#pragma omp atomic write seq_cst
+			dirty[k] = 1;
+		    }
+		    int f, d = 0, dp = 0;
+#pragma omp atomic capture seq_cst
+		    f = ++finished[k];
+		    // the last block of pass p knows that pass p - 1 is over too;
+		    // other tasks may still be writing the flags of later passes,
+		    // so they are read atomically as well
+		    if (f == nb) {
+#pragma omp atomic read seq_cst
+			d = dirty[k];
+			if (k > 0) {
+#pragma omp atomic read seq_cst
+			    dp = dirty[k - 1];
+			}
+		    }
+		    if (f == nb && !d && (k > 0 ? !dp : last_clean)) {
+#pragma omp atomic write
+			sorted = true;
+#pragma omp cancel taskgroup
+		    }
+		}
+	    }
+	
+	last_clean = !dirty[np - 1] && finished[np - 1] == nb;
+	// blocks are balanced, cancelled tasks did not count themselves
+	for (int k = 0; k < np; ++k)
+	    t.pass((double) n * finished[k] / nb, sizeof(T));
+    }
+    return t;
+}
+
+// fill, sort and check a vector of T
+template<typename T>
+void run(const int nw, const int n, const int seed, const int nb, const std::string &message) {
+    // seed allows to set up fair experiments
+    srand(seed);
+    std::vector<T> v(n);
+    for (auto &z : v) z = rand();
+    
+    traffic t;
+    long usec;
+    {
+	utimer timer(message, &usec);
+	if (nb > 0)
+	    t = oesort_omp_tasks<T>(v, nw, nb);
+	else
+	    t = oesort_omp<T>(v, nw);
+    }
+
+    assert(std::is_sorted(v.begin(), v.end()));
+    if (roofline_enabled())
+	roofline_report<T>(t, n, usec, nw);
 }
 
 int main(int argc, char* argv[]) {
-    if (argc < 4) {
-        std::cerr << "use: " << argv[0]  << " nworkers vector-length seed\n";
+    roofline_args(argc, argv);
+    if (!cmp_cost_args(argc, argv) || argc < 4) {
+        std::cerr << "use: " << argv[0];
+	std::cerr << " nworkers vector-length seed [nblocks (0 for barriers)]";
+	std::cerr << " [--cmp-cost=ns] [--cmp-class=compute|memory] [--roofline]\n";
         return -1;
     }
  
     int nw = std::stol(argv[1]);
     int n = std::stol(argv[2]);
     int seed = std::stol(argv[3]);
-    // seed allows to set up fair experiments
-    srand(seed);
-    std::vector<int> v(n);
-    for (auto &z : v) z = rand();
+    int nb = (argc == 5) ? std::stol(argv[4]) : 4 * nw;
     std::string message = argv[0];
     for (int i = 1; i < argc; ++i)
 	message += ' ' + std::string(argv[i]);
+    message += cmp_cost_describe();
     
-    {
-	utimer timer(message);
-	oesort_omp<int>(v, nw);
-    }
-
-    assert(std::is_sorted(v.begin(), v.end()));
+    // comparisons of costly_int burn the requested amount of work
+    if (cmp_cost_enabled())
+	run<costly_int>(nw, n, seed, nb, message);
+    else
+	run<int>(nw, n, seed, nb, message);
     return 0;
 }
@@ -13,162 +13,643 @@ elements' type.
 #include <algorithm>
 #include <thread>
 #include <mutex>
-#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <cstring>
+#include "alloc.hpp"
+#include "argsort.hpp"
+#include "kvpair.hpp"
+#include "cmpcost.hpp"
+#include "roofline.hpp"
+#include "checkpoint.hpp"
+#include "topk.hpp"
+#include "wait.hpp"
 #include "utimer.hpp"
 
-void oesort_pthreads_async(std::vector<int> &v, const int nw) {
-    const size_t n = v.size();
-    const int delta = n / nw;
-    int reminder = n % nw;
-    bool shutdown = false;
+struct worker_stats {
+    long scans = 0;
+    long parks = 0;
+    long rescans = 0;       // scans after a wake-up that found nothing to swap
+    long swaps = 0;
+    long chunk = 0;         // elements scanned by a scan
+    double lock_wait = 0;   // seconds spent waiting for chunk locks
+};
 
+// take m, accounting the time spent waiting for it
+inline void lock_timed(std::mutex &m, worker_stats &ws) {
+    if (m.try_lock())
+	return;
+    auto start = std::chrono::steady_clock::now();
+    m.lock();
+    ws.lock_wait += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// per-chunk state, written by the owner and by both neighbours
+struct alignas(CACHE_LINE) chunk_state {
     // ---------------------------- INVARIANT --------------------------
-    // sorted[tid] == true iff since the start of the last linear scan
+    // sorted == true iff since the start of the last linear scan
     // no out-of-order pair where found nor border transposition happened
-    // in the tid-th chunk. Therefore sorted[tid] for all tids implies
+    // in the chunk. Therefore sorted for all chunks implies
     // that the array is sorted.
-    std::vector<int> sorted(nw);
+    int sorted = 0;
     // meanwhile guaranteed the following invariant useful to enforce the one above:
-    // meanwhile[tid] == true iff one of the threads (tid - 1) or (tid + 1)
+    // meanwhile == true iff one of the threads (tid - 1) or (tid + 1)
     // performed a border transposition since the start of the current tid main loop
-    std::vector<int> meanwhile(nw);
-    
-    // mtx_block[tid] protects v[stv[tid]], sorted[tid] and meanwhile[tid] 
-    std::vector<std::mutex> mtx_block(nw);
-    // cnt counts how many chunks have sorted[] set to true
-    int cnt = 0;
-    std::mutex mtx_cnt;
-    std::condition_variable cv_cnt;
+    // (atomic, so that a parked worker can poll it without the lock)
+    std::atomic<int> meanwhile{0};
+    // mtx protects v[stv[tid]], sorted and meanwhile
+    std::mutex mtx;
+    // a worker whose chunk is sorted parks here, with the --wait
+    // policy, until a neighbour sets meanwhile or the main thread
+    // shuts down
+    wait_point park;
+};
 
-    // define worker bundaries so that they are perfectly balanced
-    // (i.e. |env[i] - env[j] - stv[i] + stv[j]| <= 1 for each i and j) 
-    std::vector<int> stv, env;
+// the states of the chunks: with ALIGNED each chunk gets its own cache
+// lines, otherwise they are laid out as in the original version, one
+// vector per field, so that neighbouring chunks share lines
+template<bool ALIGNED>
+struct chunk_states {
+    std::vector<chunk_state> cs;
+    chunk_states(int nw): cs(nw) {};
+    int &sorted(int i) { return cs[i].sorted; }
+    std::atomic<int> &meanwhile(int i) { return cs[i].meanwhile; }
+    std::mutex &mtx(int i) { return cs[i].mtx; }
+    wait_point &park(int i) { return cs[i].park; }
+};
+
+template<>
+struct chunk_states<false> {
+    std::vector<int> sorted_;
+    std::vector<std::atomic<int>> meanwhile_;
+    std::vector<std::mutex> mtx_;
+    std::vector<wait_point> park_;
+    chunk_states(int nw): sorted_(nw), meanwhile_(nw), mtx_(nw), park_(nw) {};
+    int &sorted(int i) { return sorted_[i]; }
+    std::atomic<int> &meanwhile(int i) { return meanwhile_[i]; }
+    std::mutex &mtx(int i) { return mtx_[i]; }
+    wait_point &park(int i) { return park_[i]; }
+};
+
+// define worker bundaries so that they are perfectly balanced
+// (i.e. |env[i] - env[j] - stv[i] + stv[j]| <= 1 for each i and j);
+// with ALIGNED they are rounded down to cache lines, as long as
+// chunks are at least two lines long
+template<bool ALIGNED>
+void partition(size_t n, int nw, std::vector<int> &stv, std::vector<int> &env) {
+    const size_t line = CACHE_LINE / sizeof(int);
+    if (ALIGNED && n / nw >= 2 * line) {
+	for (int i = 0; i < nw; ++i) {
+	    stv.push_back(n * i / nw / line * line);
+	    env.push_back((i < nw - 1) ? n * (i + 1) / nw / line * line : n - 1);
+	}
+	return;
+    }
+    const int delta = n / nw;
+    int reminder = n % nw;
     for (int i = 0; i < n; i += delta) {
 	stv.push_back(i);
 	if (reminder-- > 0) i++;
 	env.push_back((i + delta < n) ? (i + delta) : (n - 1));
     }
+}
+
+// run nw workers over v until it is sorted or, if seconds > 0, until
+// seconds have elapsed: returns whether v is sorted. Every worker
+// completes at least one scan of its chunk, whatever seconds, so that
+// a sorted v is recognised even when a scan outlasts the run. chunks
+// carries the sorted flags of the chunks from a run to the next one
+// with the same nw (it is reset otherwise): a chunk that was sorted
+// parks at once instead of being scanned again
+template<bool ALIGNED, typename V>
+bool async_workers(V &v, const int nw, const double seconds, std::vector<int> &chunks,
+		   std::vector<worker_stats> &stats) {
+    const size_t n = v.size();
+    std::atomic<bool> shutdown{false};
+
+    chunk_states<ALIGNED> cs(nw);
+    // cnt counts how many chunks have sorted set to true
+    std::atomic<int> cnt{0};
+    if (chunks.size() != (size_t) nw)
+	chunks.assign(nw, 0);
+    for (int i = 0; i < nw; ++i) {
+	cs.sorted(i) = chunks[i];
+	cnt += chunks[i];
+    }
+    std::mutex mtx_cnt;
+    // the main thread waits here for cnt == nw
+    wait_point done;
+
+    std::vector<int> stv, env;
+    partition<ALIGNED>(n, nw, stv, env);
+
+    // per-worker statistics: scans performed, parks and wasted re-scans
+    stats.assign(nw, worker_stats());
 
     // this is the worker's body
     auto body = [&](int tid) {
 		    int st = stv[tid];
 		    int en = env[tid];
+		    worker_stats ws;
+		    ws.chunk = en - st + 1;
 
-		    // main loop
-		    while (!shutdown) {
+		    // a chunk left sorted by the previous run is not scanned
+		    // again until a neighbour swaps across its border
+		    bool first = true;
+		    // whether the worker was woken since its last scan
+		    bool woken = false;
+		    {
+			std::unique_lock<std::mutex> lk(cs.mtx(tid));
+			if (cs.sorted(tid)) {
+			    ws.parks++;
+			    lk.unlock();
+			    cs.park(tid).wait([&]{return cs.meanwhile(tid) || shutdown;});
+			    woken = true;
+			    first = false;
+			}
+		    }
+
+		    // main loop, entered at least once by a chunk to scan
+		    for (; first || !shutdown; first = false) {
 			// local_sorted == false iff we found out-of-order pairs
 			bool local_sorted = true;
-			mtx_block[tid].lock();
-			meanwhile[tid] = false;
-			mtx_block[tid].unlock();
+			lock_timed(cs.mtx(tid), ws);
+			cs.meanwhile(tid) = false;
+			cs.mtx(tid).unlock();
 			
 			for (int j : {0, 1}) { // even and odd iteration
 			    for (int i = st + j; i < en; i += 2) {
 				// right border case
 				if (i == en - 1 && en != n - 1) {
-				    mtx_block[tid + 1].lock();
+				    lock_timed(cs.mtx(tid + 1), ws);
 				    if (v[en] < v[en - 1]) {
 					std::swap(v[en], v[en - 1]);
+					ws.swaps++;
 					local_sorted = false;
-					meanwhile[tid + 1] = true;
-					if (sorted[tid + 1]) {
-					    sorted[tid + 1] = false;
+					cs.meanwhile(tid + 1) = true;
+					cs.park(tid + 1).notify();
+					if (cs.sorted(tid + 1)) {
+					    cs.sorted(tid + 1) = false;
 					    mtx_cnt.lock();
 					    --cnt;
 					    mtx_cnt.unlock();
 					}
 				    }
-				    mtx_block[tid + 1].unlock();
+				    cs.mtx(tid + 1).unlock();
 				}
 				else {
 				    // left border case
 				    if (i == st && st != 0) {
-					mtx_block[tid].lock();
+					lock_timed(cs.mtx(tid), ws);
 					if (v[st + 1] < v[st]) {
 					    std::swap(v[st + 1], v[st]);
+					    ws.swaps++;
 					    local_sorted = false;
-					    mtx_block[tid - 1].lock();
-					    meanwhile[tid - 1] = true;
-					    if (sorted[tid - 1]) {
-						sorted[tid - 1] = false;
+					    lock_timed(cs.mtx(tid - 1), ws);
+					    cs.meanwhile(tid - 1) = true;
+					    cs.park(tid - 1).notify();
+					    if (cs.sorted(tid - 1)) {
+						cs.sorted(tid - 1) = false;
 						mtx_cnt.lock();
 						--cnt;
 						mtx_cnt.unlock();
 					    }
-					    mtx_block[tid - 1].unlock();
+					    cs.mtx(tid - 1).unlock();
 					}
-					mtx_block[tid].unlock();
+					cs.mtx(tid).unlock();
 				    }
 				    // internal case
 				    else {
 					if (v[i + 1] < v[i]) {
 					    std::swap(v[i + 1], v[i]);
+					    ws.swaps++;
 					    local_sorted = false;
 					}
 				    }
 				}
 			    }
 			}
-			// set sorted[tid]
+			ws.scans++;
+			// a neighbour's border swap woke us for nothing
+			if (woken && local_sorted)
+			    ws.rescans++;
+			woken = false;
+			// set the chunk's sorted
 			if (local_sorted) {
-			    mtx_block[tid].lock();
-			    if (!meanwhile[tid] && !sorted[tid]) {
-				sorted[tid] = true;
-				mtx_cnt.lock();
-				++cnt;
-				mtx_cnt.unlock();
-				// notify main thread that vector is sorted
-				if (cnt == nw) cv_cnt.notify_one();
+			    std::unique_lock<std::mutex> lk(cs.mtx(tid));
+			    if (!cs.meanwhile(tid)) {
+				if (!cs.sorted(tid)) {
+				    cs.sorted(tid) = true;
+				    mtx_cnt.lock();
+				    ++cnt;
+				    mtx_cnt.unlock();
+				    // notify main thread that vector is sorted
+				    if (cnt == nw) done.notify();
+				}
+				// nothing can change in this chunk until a neighbour
+				// performs a border transposition, so park instead of
+				// scanning it again
+				ws.parks++;
+				lk.unlock();
+				cs.park(tid).wait([&]{return cs.meanwhile(tid) || shutdown;});
+				woken = true;
 			    }
-			    mtx_block[tid].unlock();
 			}
 		    }
+		    stats[tid] = ws;
 		};
 
     // spawn threads
     std::vector<std::thread*> tids(nw);
     for (int i = 0; i < nw; ++i)
 	tids[i] = new std::thread(body, i);
-    {
-	std::unique_lock<std::mutex> lk(mtx_cnt);
-	cv_cnt.wait(lk, [&]{return cnt == nw;});
-    }
+    auto deadline = std::chrono::steady_clock::time_point::max();
+    if (seconds > 0)
+	deadline = std::chrono::steady_clock::now() +
+	    std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+		std::chrono::duration<double>(seconds));
+    done.wait([&]{return cnt == nw;}, deadline);
     // shut down every thread
-    shutdown = true;  // benign data race
+    shutdown = true;
+    // wake parked workers
+    for (int i = 0; i < nw; ++i)
+	cs.park(i).notify();
     // join threads and destruct thread objects
     for (int i = 0; i < nw; ++i) {
 	tids[i]->join();
 	delete tids[i];
     }
+    for (int i = 0; i < nw; ++i)
+	chunks[i] = cs.sorted(i);
+    // chunks may have been found sorted after the deadline
+    return cnt == nw;
+}
+
+// ---------------------------- CHECKPOINTS -------------------------
+// Workers have no global step, so the cut point of a checkpoint is the
+// end of a run of async_workers: every thread has exited and v is a
+// permutation of the input, from which the sort can start again. With
+// checkpoints the workers run for --checkpoint-every seconds at a time.
+// The sorted flags of the nw chunks a run starts with are saved in the
+// meta words, so that a restart does not scan the sorted chunks again.
+template<typename V>
+void checkpoint_restore(V &v, std::vector<int> &chunks, const int nw, const checkpoint *ck) {
+    if (!ck || !ck->resumed())
+	return;
+    std::memcpy((void *) v.data(), ck->data(), v.size() * sizeof(v[0]));
+    chunks.assign(ck->meta(), ck->meta() + nw);
+}
+
+template<typename V>
+void checkpoint_save(const V &v, const std::vector<int> &chunks, const int nw, checkpoint *ck) {
+    ck->save([&](int64_t *meta, void *data) {
+		 // other chunks (--adaptive) are not those of a restart
+		 const bool keep = chunks.size() == (size_t) nw;
+		 for (int i = 0; i < nw; ++i)
+		     meta[i] = keep ? chunks[i] : 0;
+		 std::memcpy(data, (const void *) v.data(), v.size() * sizeof(v[0]));
+	     });
+}
+
+// it returns the memory traffic of the scans
+template<bool ALIGNED, typename V>
+traffic oesort_pthreads_async(V &v, const int nw, checkpoint *ck) {
+    std::vector<int> chunks;
+    checkpoint_restore(v, chunks, nw, ck);
+    std::vector<worker_stats> stats, run_stats;
+    const double seconds = ck ? checkpoint_cfg().every : 0;
+    stats.assign(nw, worker_stats());
+    for (bool sorted = false; !sorted; ) {
+	sorted = async_workers<ALIGNED>(v, nw, seconds, chunks, run_stats);
+	for (int i = 0; i < nw; ++i) {
+	    stats[i].scans += run_stats[i].scans;
+	    stats[i].parks += run_stats[i].parks;
+	    stats[i].rescans += run_stats[i].rescans;
+	    stats[i].chunk = run_stats[i].chunk;
+	}
+	if (!sorted)
+	    checkpoint_save(v, chunks, nw, ck);
+    }
+
+    // the totals go to stderr, leaving the timing line alone on stdout
+    worker_stats tot;
+    traffic t;
+    for (int i = 0; i < nw; ++i) {
+	// a scan is an odd and an even pass over the chunk
+	t.pass(stats[i].chunk, sizeof(v[0]), 2.0 * stats[i].scans);
+	tot.scans += stats[i].scans;
+	tot.parks += stats[i].parks;
+	tot.rescans += stats[i].rescans;
+    }
+    std::cerr << "workers: " << tot.scans << " scans, " << tot.parks << " parks, "
+	      << tot.rescans << " wasted re-scans\n";
+    return t;
+}
+
+// ---------------------------- CONTROLLER --------------------------
+// The adaptive version runs the workers in epochs of a few milliseconds.
+// Between two epochs every thread has exited, so the chunks can be
+// merged or split freely and the cores of the workers that are not
+// needed go back to the system. The controller hill-climbs on the
+// throughput (elements scanned per second): it accepts fewer workers as
+// long as less than SHRINK_LOSS of it is lost, and more workers only if
+// at least GROW_GAIN is gained, so that the number of workers settles at
+// the knee of the scalability curve. Spending more than MAX_LOCK_WAIT of
+// the time waiting for chunk locks pushes towards fewer, larger chunks.
+// Once both directions have been rejected the level is kept for SETTLE
+// epochs before probing again, since the best level drifts as the
+// vector gets sorted.
+struct concurrency_controller {
+    static constexpr double SHRINK_LOSS = 0.05;
+    static constexpr double GROW_GAIN = 0.10;
+    static constexpr double MAX_LOCK_WAIT = 0.10;
+    static constexpr int SETTLE = 8;
+    const int max_nw;
+    int nw;           // workers of the next epoch
+    int base;         // accepted number of workers
+    double base_thr = 0;
+    double base_wait = 0;
+    int dir = -1;     // direction of the next probe
+    int rejected = 0; // probes rejected since the last accepted one
+    int idle = 0;     // epochs spent at a settled level
+
+    concurrency_controller(int max_nw): max_nw(max_nw), nw(max_nw), base(max_nw) {};
+
+    void probe() {
+	for (int tries = 0; tries < 2; ++tries) {
+	    int next = std::min(max_nw, std::max(1, base + dir * std::max(1, base / 4)));
+	    if (next != base) {
+		nw = next;
+		return;
+	    }
+	    // nothing to probe in this direction
+	    dir = -dir;
+	    ++rejected;
+	}
+	nw = base;
+    }
+
+    // thr is the throughput of the last epoch, wait the share of
+    // its time spent by workers waiting for locks
+    void update(double thr, double wait) {
+	if (nw == base) {
+	    // the accepted level is measured again, the data evolve
+	    base_thr = thr;
+	    base_wait = wait;
+	    if (rejected >= 2 && ++idle < SETTLE)
+		return;
+	    idle = 0;
+	    rejected = 0;
+	    probe();
+	    return;
+	}
+	const bool accept = (nw < base) ?
+	    thr >= (1 - SHRINK_LOSS) * base_thr || base_wait > MAX_LOCK_WAIT :
+	    thr >= (1 + GROW_GAIN) * base_thr && wait <= MAX_LOCK_WAIT;
+	if (accept) {
+	    // keep moving in the same direction
+	    base = nw;
+	    base_thr = thr;
+	    base_wait = wait;
+	    rejected = 0;
+	    probe();
+	}
+	else {
+	    // back to the accepted level, the next probe goes the other way
+	    dir = -dir;
+	    ++rejected;
+	    nw = base;
+	}
+    }
+};
+
+// at most max_nw workers, re-balanced every epoch_ms milliseconds and
+// checkpointed between two epochs; it returns the memory traffic of
+// the scans
+template<bool ALIGNED, typename V>
+traffic oesort_pthreads_adaptive(V &v, const int max_nw, const int epoch_ms, checkpoint *ck) {
+    // the flags of the chunks last as long as the number of workers
+    std::vector<int> chunks;
+    checkpoint_restore(v, chunks, max_nw, ck);
+    concurrency_controller ctl(max_nw);
+    std::vector<worker_stats> stats;
+    traffic t;
+    // the number of workers of the epochs, run-length encoded
+    std::vector<std::pair<int, int>> trace;
+    bool sorted = false;
+    while (!sorted) {
+	const int nw = ctl.nw;
+	auto start = std::chrono::steady_clock::now();
+	sorted = async_workers<ALIGNED>(v, nw, epoch_ms * 1e-3, chunks, stats);
+	double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	traffic et;
+	double wait = 0;
+	for (auto &ws : stats) {
+	    et.pass(ws.chunk, sizeof(v[0]), 2.0 * ws.scans);
+	    wait += ws.lock_wait;
+	}
+	t += et;
+	ctl.update(et.elem_passes / sec, wait / (nw * sec));
+	if (trace.empty() || trace.back().first != nw)
+	    trace.push_back({nw, 0});
+	trace.back().second++;
+	if (ck && !sorted && ck->due())
+	    checkpoint_save(v, chunks, max_nw, ck);
+    }
+
+    // statistics go to stderr, leaving the timing line alone on stdout
+    std::cerr << "workers per epoch:";
+    for (auto &e : trace)
+	std::cerr << ' ' << e.first << 'x' << e.second;
+    std::cerr << '\n';
+    return t;
+}
+
+// sort v, epoch_ms > 0 selects the adaptive version; records are sorted
+// through a (key, index) array in argsort mode, and perm receives the
+// permutation if it is not applied. ck checkpoints the array sorted
+template<bool ALIGNED, typename V>
+traffic sort_elements(V &v, const int nw, const int epoch_ms, std::vector<int> &perm,
+		      checkpoint *ck) {
+    auto sort = [&](auto &u) {
+		    if (epoch_ms > 0)
+			return oesort_pthreads_adaptive<ALIGNED>(u, nw, epoch_ms, ck);
+		    return oesort_pthreads_async<ALIGNED>(u, nw, ck);
+		};
+    if constexpr (is_record<typename V::value_type>::value)
+	if (record_cfg().argsort)
+	    return argsort(v, nw, perm, sort);
+    return sort(v);
+}
+
+// fill, sort and check a vector of V's type allocated by V's allocator
+template<bool ALIGNED, typename V>
+int run(const int nw, const int n, const int seed, const int epoch_ms,
+	const std::string &message) {
+    // seed allows to set up fair experiments
+    srand(seed);
+    V v(n);
+    fill_random(v);
+    // in top-k mode only the k smallest elements are sorted
+    V input;
+    if (topk_enabled())
+	input = v;
+
+    // the elements sorted are (key, index) pairs in argsort mode; the
+    // layout and nw do not change them
+    size_t elem_size = sizeof(typename V::value_type);
+    if constexpr (is_record<typename V::value_type>::value)
+	if (record_cfg().argsort)
+	    elem_size = sizeof(typename key_vector<V>::value_type);
+    // chunks need at least a pair, which matters for a small k
+    const int enw = std::max(1, std::min<int>(nw, topk_size(n) / 2));
+    // the sorted flags of the enw chunks are saved along with the
+    // elements, a checkpoint is resumed by the same number of workers
+    std::unique_ptr<checkpoint> ck;
+    if (checkpoint_enabled())
+	ck.reset(new checkpoint("pthread-async " + std::to_string(n) + ' ' + std::to_string(seed) +
+				record_describe() + kv_describe() + topk_describe() +
+				cmp_cost_describe(),
+				topk_size(n), elem_size, enw));
+    traffic t;
+    long usec;
+    std::vector<int> perm;
+    {
+	utimer timer(message, &usec);
+	if (topk_enabled())
+	    v = topk_select(v, topk_cfg().k, nw);
+	t = sort_elements<ALIGNED>(v, enw, epoch_ms, perm, ck.get());
+	// wide payloads follow their keys
+	kv_finish(v, nw);
+    }
+
+    // check that the algorithm is correct
+    if (!check_sorted(v, perm)) {
+	std::cout << "VECTOR IS NOT SORTED!" << std::endl;
+	return -1;
+    }
+    if (!kv_check(v)) {
+	std::cout << "PAIRS TORN APART!" << std::endl;
+	return -1;
+    }
+    if (topk_enabled()) {
+	V top(v.size());
+	for (size_t i = 0; i < v.size(); ++i)
+	    top[i] = perm.empty() ? v[i] : v[perm[i]];
+	if (!topk_check(input, top)) {
+	    std::cout << "NOT THE TOP " << topk_cfg().k << "!" << std::endl;
+	    return -1;
+	}
+    }
+    if (ck)
+	ck->finish(usec / 1e6);
+    wait_report();
+    if (roofline_enabled()) {
+	// in argsort mode the passes scan the (key, index) array
+	if constexpr (is_record<typename V::value_type>::value)
+	    if (record_cfg().argsort) {
+		roofline_report<typename key_vector<V>::value_type>(t, v.size(), usec, enw);
+		return 0;
+	    }
+	roofline_report<typename V::value_type>(t, v.size(), usec, enw);
+    }
+    return 0;
+}
+
+// pick the allocator of the requested layout for vectors of T
+template<typename T>
+int run_layout(const int nw, const int n, const int seed, const std::string &layout,
+	       const int epoch_ms, const std::string &message) {
+    // comparing layouts gives the before and after numbers
+    // of cache-line alignment and huge pages
+    if (layout == "packed")
+	return run<false, std::vector<T>>(nw, n, seed, epoch_ms, message);
+    if (layout == "aligned")
+	return run<true, std::vector<T, aligned_allocator<T>>>(nw, n, seed, epoch_ms, message);
+    if (layout == "huge")
+	return run<true, std::vector<T, huge_page_allocator<T>>>(nw, n, seed, epoch_ms, message);
+    std::cerr << "unknown layout " << layout << '\n';
+    return -1;
+}
+
+// sort bare keys of type K, or records holding one
+template<typename K>
+int run_keys(const int nw, const int n, const int seed, const std::string &layout,
+	     const int epoch_ms, const std::string &message) {
+    switch (record_cfg().bytes) {
+    case 64:
+	return run_layout<record<K, 64>>(nw, n, seed, layout, epoch_ms, message);
+    case 128:
+	return run_layout<record<K, 128>>(nw, n, seed, layout, epoch_ms, message);
+    case 256:
+	return run_layout<record<K, 256>>(nw, n, seed, layout, epoch_ms, message);
+    }
+    return run_layout<K>(nw, n, seed, layout, epoch_ms, message);
+}
+
+// strip --adaptive[=<epoch-ms>] from the command line, returns the
+// epoch length in milliseconds or 0 if it is absent
+int adaptive_args(int &argc, char *argv[]) {
+    int epoch_ms = 0;
+    int k = 1;
+    for (int i = 1; i < argc; ++i) {
+	std::string a = argv[i];
+	if (a == "--adaptive")
+	    epoch_ms = 20;
+	else if (a.rfind("--adaptive=", 0) == 0)
+	    epoch_ms = std::max(1L, std::stol(a.substr(11)));
+	else
+	    argv[k++] = argv[i];
+    }
+    argc = k;
+    return epoch_ms;
 }
 
 int main(int argc, char* argv[]) {
-    if (argc < 4) {
-        std::cerr << "use: " << argv[0]  << " nworkers vector-length seed\n";
+    roofline_args(argc, argv);
+    const int epoch_ms = adaptive_args(argc, argv);
+    if (!record_args(argc, argv) || !kv_args(argc, argv) || !cmp_cost_args(argc, argv) ||
+	!checkpoint_args(argc, argv) || !topk_args(argc, argv) || !wait_args(argc, argv) ||
+	argc < 4) {
+        std::cerr << "use: " << argv[0];
+	std::cerr << " nworkers vector-length seed [layout (packed, aligned or huge)]";
+	std::cerr << " [--adaptive[=epoch-ms]] [--wait=spin|yield|futex|block]";
+	std::cerr << " [--records=64|128|256 [--argsort[=gather|cycle|none]]]";
+	std::cerr << " [--kv[=packed|struct] [--kv-payload=bytes]] [--top-k=k]";
+	std::cerr << " [--cmp-cost=ns] [--cmp-class=compute|memory] [--roofline]";
+	std::cerr << " [--checkpoint=file [--checkpoint-every=sec] [--resume]]\n";
         return -1;
     }
  
     const int nw = std::stol(argv[1]);
     const int n = std::stol(argv[2]);
     const int seed = std::stol(argv[3]);
-    // seed allows to set up fair experiments
-    srand(seed);
-    std::vector<int> v(n);
-    for (auto &z : v) z = rand();
+    const std::string layout = (argc == 5) ? argv[4] : "aligned";
     // writing a message, a useful log for managing experiments
     std::string message = argv[0];
     for (int i = 1; i < argc; ++i)
 	message += ' ' + std::string(argv[i]);
-    
-    {
-	utimer timer(message);
-	oesort_pthreads_async(v, nw);
-    }
+    if (epoch_ms > 0)
+	message += " --adaptive=" + std::to_string(epoch_ms);
+    message += wait_describe();
+    message += record_describe();
+    message += kv_describe();
+    message += topk_describe();
+    message += cmp_cost_describe();
 
-    // check that the algorithm is correct
-    if (!std::is_sorted(v.begin(), v.end())) {
-	std::cout << "VECTOR IS NOT SORTED!" << std::endl;
+    if (kv_enabled() && (record_cfg().bytes != 0 || cmp_cost_enabled())) {
+	std::cerr << "--kv sorts integer keys\n";
 	return -1;
     }
-    return 0;
+    // pairs packed in a word or in a struct
+    if (kv_cfg().layout == KV_PACKED)
+	return run_layout<kv_pair>(nw, n, seed, layout, epoch_ms, message);
+    if (kv_cfg().layout == KV_STRUCT)
+	return run_layout<kv_struct>(nw, n, seed, layout, epoch_ms, message);
+
+    // comparisons of costly_int burn the requested amount of work
+    if (cmp_cost_enabled())
+	return run_keys<costly_int>(nw, n, seed, layout, epoch_ms, message);
+    return run_keys<int>(nw, n, seed, layout, epoch_ms, message);
 }
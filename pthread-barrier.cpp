@@ -6,32 +6,45 @@
 #include <iostream>
 #include <vector>
 #include <algorithm>
-#include <cassert>
+#include <memory>
+#include <cstring>
 #include <thread>
-#include <mutex>
-#include <condition_variable>
+#include <atomic>
+#include <climits>
+#include "alloc.hpp"
+#include "barrier.hpp"
+#include "wait.hpp"
+#include "cmpcost.hpp"
+#include "roofline.hpp"
+#include "strkey.hpp"
+#include "kvpair.hpp"
+#include "checkpoint.hpp"
+#include "topk.hpp"
 #include "utimer.hpp"
 
 // this version exploit a barrier implemented by myself
 // using a synchronization mechanism orchestrated by
-// the main thread.
+// the main thread. It returns the memory traffic of the passes.
+// The handoff of barrier.hpp carries it out: workers wait for the main
+// thread to start a pass, the main thread waits for every worker to end
+// it, both with the --wait policy (blocking by default).
+// Between two passes every thread is parked, which makes it the cut
+// point for checkpoints: v and the parity of the last pass are saved
+// in ck, if any, and the sort goes on from them if ck was resumed.
 
 template<typename T>
-void oesort_pthreads_sync(std::vector<T> &v, int nw) {
+traffic oesort_pthreads_sync(std::vector<T> &v, int nw, checkpoint *ck = nullptr) {
     size_t n = v.size();
     int delta = n / nw;
     int reminder = n % nw;
-    bool shutdown = false;
     int parity = 0;
+    long passes = 0;
+    if (ck && ck->resumed()) {
+	std::memcpy(v.data(), ck->data(), n * sizeof(T));
+	parity = ck->meta()[0];
+	passes = ck->meta()[1];
+    }
     bool sorted = false;
-
-    std::vector<bool> jd(nw, true);
-    std::mutex mtx_jd;
-    std::condition_variable cv_jd;
-    
-    int cnt = 0;
-    std::mutex mtx_cnt;
-    std::condition_variable cv_cnt;
     
     // define worker bundaries so that they are perfectly balanced
     std::vector<int> stv, env;
@@ -40,32 +53,19 @@ void oesort_pthreads_sync(std::vector<T> &v, int nw) {
 	if (reminder-- > 0) i++;
 	env.push_back((i + delta < n) ? (i + delta) : (n - 1));
     }
+    handoff h(nw);
 
     auto body = [&](int tid) {
 		    int st = stv[tid];
 		    int en = env[tid];
+		    int seen = 0;
 		    
-		    while (!shutdown) {
-			{
-			    std::unique_lock<std::mutex> lk(mtx_jd);
-			    cv_jd.wait(lk, [&]{return !jd[tid];});
-			}
+		    while (h.next(seen)) {
 			// do the job
-			for (int i = st + ((st & 1) ^ parity); i < en; i += 2) {
-			  if (v[i + 1] < v[i]) {
-				std::swap(v[i + 1], v[i]);
-				sorted = false;  // benign data race
-			    }
-			}
-			// mark the jobe as done in jd[tid]
-			mtx_jd.lock();
-			jd[tid] = true;
-			mtx_jd.unlock();
+			if (oe_pass(v.data(), st, en + 1, parity))
+			    sorted = false;  // benign data race
 			// update the done-jobs counter 
-			mtx_cnt.lock();
-			++cnt;
-			mtx_cnt.unlock();
-			if (cnt == nw) cv_cnt.notify_one();
+			h.end();
 		    }
 		};
 
@@ -75,59 +75,280 @@ void oesort_pthreads_sync(std::vector<T> &v, int nw) {
 	tids[i] = new std::thread(body, i);
 
     // main loop
+    traffic t;
     while (!sorted) {
   	parity = 1 - parity;
 	sorted = true;
+	t.pass(n, sizeof(T));
 
-	// reset jd vector
-	mtx_jd.lock();
-	for (int i = 0; i < nw; ++i) jd[i] = false;
-	mtx_jd.unlock();
-	cv_jd.notify_all();
+	// start the pass
+	h.start();
 	// wait for every thread to do its job
-     	{
-	    std::unique_lock<std::mutex> lk(mtx_cnt);
-	    cv_cnt.wait(lk, [&]{return cnt == nw;});
-	    cnt = 0;
-	}
+	h.finish();
+	++passes;
+	if (ck && !sorted && ck->due())
+	    ck->save([&](int64_t *meta, void *data) {
+			 meta[0] = parity;
+			 meta[1] = passes;
+			 std::memcpy(data, v.data(), n * sizeof(T));
+		     });
     }
 
     // shut down every thread
-    shutdown = true;
-    mtx_jd.lock();
-    for (int i = 0; i < nw; ++i) jd[i] = false;
-    mtx_jd.unlock();
-    cv_jd.notify_all();
+    h.stop();
     // join threads and destruct thread objects
     for (int i = 0; i < nw; ++i) {
 	tids[i]->join();
 	delete tids[i];
     }
+    return t;
+}
+
+// ---------------------------- NEIGHBOUR EPOCHS ----------------------
+// This version has no global barrier. Worker i owns the pairs (j, j + 1)
+// with stv[i] <= j < env[i], and pass p over them reads elements that
+// only neighbours i - 1 and i + 1 may have written in pass p - 1: so
+// worker i waits for its two neighbours to publish epoch p (the number
+// of passes they completed) before running pass p, and every element
+// goes through exactly the same values as in oesort_seq, odd pass first.
+// Neighbours lag by at most one pass, so nobody can be reading what a
+// pass is writing.
+//
+// Termination is decided as in oesort_seq, after the first round (an
+// odd and an even pass) in which nobody swapped, and is reduced lazily:
+// each worker publishes with its epoch the pass since which its pairs
+// have been clean, and only a worker finishing a round clean itself
+// reads the others'. If clean_from is the latest of these and round r
+// is the first round starting at or after it, then once every epoch
+// reaches 2r + 2 round r was clean everywhere, and no earlier round
+// was, otherwise no swap could have happened after it. Workers running
+// ahead meanwhile see a sorted vector and swap nothing, so both the
+// result and the pass count, 2r + 2, are those of oesort_seq.
+//
+// Waiting for a neighbour uses the --wait policy, by default spinning
+// for a while and then sleeping on a futex, woken by the neighbour
+// only if somebody sleeps.
+
+struct alignas(CACHE_LINE) epoch_state {
+    std::atomic<int> epoch{0};     // passes completed
+    std::atomic<int> clean{0};     // last pass swapping one of the pairs, plus one
+    wait_point wp{WAIT_FUTEX};     // where the neighbours wait for epoch
+};
+
+// it returns the memory traffic of the passes of oesort_seq, and their
+// number in passes
+template<typename T>
+traffic oesort_pthreads_epoch(std::vector<T> &v, int nw, int &passes) {
+    const int n = v.size();
+    if (n == 0)
+	return traffic();
+    std::vector<epoch_state> es(nw);
+    // the number of passes to stop at, once it is known
+    std::atomic<int> stop{INT_MAX};
+
+    // the same bundaries as oesort_pthreads_sync
+    std::vector<int> stv, env;
+    int delta = n / nw;
+    int reminder = n % nw;
+    for (int i = 0; i < n; i += delta) {
+	stv.push_back(i);
+	if (reminder-- > 0) i++;
+	env.push_back((i + delta < n) ? (i + delta) : (n - 1));
+    }
+    nw = stv.size();
+
+    // wait for es[i].epoch >= p, or for the stop to come before it
+    auto wait_epoch = [&](int i, int p) {
+			  es[i].wp.wait([&]{
+					    return es[i].epoch.load(std::memory_order_acquire) >= p ||
+						stop.load() <= p;
+					});
+		      };
+
+    // clean_from and the lowest epoch; the stop if they prove it
+    auto try_stop = [&]() {
+			int clean_from = 0, frontier = INT_MAX;
+			for (int i = 0; i < nw; ++i) {
+			    frontier = std::min(frontier, es[i].epoch.load(std::memory_order_acquire));
+			    clean_from = std::max(clean_from, es[i].clean.load(std::memory_order_relaxed));
+			}
+			const int round_end = (clean_from + 1) / 2 * 2 + 2;
+			if (frontier < round_end)
+			    return;
+			int inf = INT_MAX;
+			if (stop.compare_exchange_strong(inf, round_end))
+			    for (int i = 0; i < nw; ++i)
+				es[i].wp.notify();
+		    };
+
+    auto body = [&](int tid) {
+		    const int st = stv[tid];
+		    const int en = env[tid];
+		    int clean = 0;
+		    for (int p = 0; p < stop.load(); ++p) {
+			if (tid > 0) wait_epoch(tid - 1, p);
+			if (tid < nw - 1) wait_epoch(tid + 1, p);
+			if (p >= stop.load())
+			    break;
+			// odd pass first, as in oesort_seq
+			if (oe_pass(v.data(), st, en + 1, (p & 1) ? 0 : 1)) {
+			    clean = p + 1;
+			    es[tid].clean.store(clean, std::memory_order_relaxed);
+			}
+			es[tid].epoch.store(p + 1, std::memory_order_release);
+			es[tid].wp.notify();
+			// a round is over and it was clean here
+			if ((p & 1) && clean < p)
+			    try_stop();
+		    }
+		};
+
+    std::vector<std::thread> tids;
+    for (int i = 0; i < nw; ++i)
+	tids.emplace_back(body, i);
+    for (auto &t : tids)
+	t.join();
+
+    passes = stop.load();
+    traffic t;
+    t.pass(n, sizeof(T), passes);
+    return t;
+}
+
+// fill, sort and check a vector of T
+template<typename T>
+int run(const int nw, const int n, const int seed, const bool epochs,
+	const std::string &message) {
+    // seed allows to set up fair experiments
+    srand(seed);
+    std::vector<T> v(n);
+    fill_random(v);
+    // in top-k mode only the k smallest elements are sorted
+    std::vector<T> input;
+    if (topk_enabled())
+	input = v;
+    
+    // the parameters a checkpoint depends on, nw does not matter
+    std::unique_ptr<checkpoint> ck;
+    if (checkpoint_enabled())
+	ck.reset(new checkpoint("pthread-barrier " + std::to_string(n) + ' ' +
+				std::to_string(seed) + kv_describe() + topk_describe() +
+				cmp_cost_describe(),
+				topk_size(n), sizeof(T), 2));
+
+    // chunks need at least a pair, which matters for a small k
+    const int enw = std::max(1, std::min<int>(nw, topk_size(n) / 2));
+    traffic t;
+    long usec;
+    int passes = 0;
+    {
+	utimer timer(message, &usec);
+	if (topk_enabled())
+	    v = topk_select(v, topk_cfg().k, nw);
+	t = epochs ? oesort_pthreads_epoch<T>(v, enw, passes) : oesort_pthreads_sync<T>(v, enw, ck.get());
+	// wide payloads follow their keys
+	kv_finish(v, nw);
+    }
+
+    // check that the algorithm is correct
+    if (!std::is_sorted(v.begin(), v.end())) {
+	std::cout << "VECTOR IS NOT SORTED!" << std::endl;
+	return -1;
+    }
+    if (topk_enabled() && !topk_check(input, v)) {
+	std::cout << "NOT THE TOP " << topk_cfg().k << "!" << std::endl;
+	return -1;
+    }
+    if (!kv_check(v)) {
+	std::cout << "PAIRS TORN APART!" << std::endl;
+	return -1;
+    }
+    if (ck)
+	ck->finish(usec / 1e6);
+    // statistics go to stderr, leaving the timing line alone on stdout
+    if (epochs)
+	std::cerr << "passes: " << passes << '\n';
+    wait_report();
+    if (roofline_enabled())
+	roofline_report<T>(t, v.size(), usec, enw);
+    return 0;
+}
+
+// strip --sync=barrier|epoch from the command line, returns whether
+// the neighbour-epoch version is selected
+bool sync_args(int &argc, char *argv[], bool &ok) {
+    bool epochs = false;
+    int k = 1;
+    for (int i = 1; i < argc; ++i) {
+	std::string a = argv[i];
+	if (a == "--sync=epoch")
+	    epochs = true;
+	else if (a == "--sync=barrier")
+	    epochs = false;
+	else if (a.rfind("--sync", 0) == 0)
+	    ok = false;
+	else
+	    argv[k++] = argv[i];
+    }
+    argc = k;
+    return epochs;
 }
 
 int main(int argc, char* argv[]) {
-    if (argc < 4) {
-        std::cerr << "use: " << argv[0]  << " nworkers vector-length seed\n";
+    roofline_args(argc, argv);
+    bool ok = true;
+    const bool epochs = sync_args(argc, argv, ok);
+    if (!string_args(argc, argv) || !kv_args(argc, argv) || !cmp_cost_args(argc, argv) ||
+	!checkpoint_args(argc, argv) || !topk_args(argc, argv) || !wait_args(argc, argv) ||
+	!ok || argc < 4) {
+        std::cerr << "use: " << argv[0]  << " nworkers vector-length seed [--sync=barrier|epoch]";
+	std::cerr << " [--wait=spin|yield|futex|block]";
+	std::cerr << " [--strings=8|16] [--kv[=packed|struct] [--kv-payload=bytes]] [--top-k=k]";
+	std::cerr << " [--cmp-cost=ns] [--cmp-class=compute|memory] [--roofline]";
+	std::cerr << " [--checkpoint=file [--checkpoint-every=sec] [--resume]]\n";
         return -1;
     }
+    // handles point into memory of this process
+    if (string_cfg().prefix != 0 && checkpoint_enabled()) {
+	std::cerr << "string keys cannot be checkpointed\n";
+	return -1;
+    }
+    if (kv_enabled() && (string_cfg().prefix != 0 || cmp_cost_enabled())) {
+	std::cerr << "--kv sorts integer keys\n";
+	return -1;
+    }
+    // workers are never stopped all at the same pass
+    if (epochs && checkpoint_enabled()) {
+	std::cerr << "--sync=epoch has no cut point for checkpoints\n";
+	return -1;
+    }
  
     int nw = std::stol(argv[1]);
     int n = std::stol(argv[2]);
     int seed = std::stol(argv[3]);
-    // seed allows to set up fair experiments
-    srand(seed);
-    std::vector<int> v(n);
-    for (auto &z : v) z = rand();
-
     std::string message = argv[0];
     for (int i = 1; i < argc; ++i)
 	message += ' ' + std::string(argv[i]);
+    if (epochs)
+	message += " --sync=epoch";
+    message += wait_describe();
+    message += string_describe();
+    message += kv_describe();
+    message += topk_describe();
+    message += cmp_cost_describe();
     
-    {
-	utimer timer(message);
-	oesort_pthreads_sync<int>(v, nw);
-    }
-
-    assert(std::is_sorted(v.begin(), v.end()));
-    return 0;
+    // string handles carry a prefix of 8 or 16 bytes
+    if (string_cfg().prefix == 8)
+	return run<str_handle<8>>(nw, n, seed, epochs, message);
+    if (string_cfg().prefix == 16)
+	return run<str_handle<16>>(nw, n, seed, epochs, message);
+    // pairs packed in a word or in a struct
+    if (kv_cfg().layout == KV_PACKED)
+	return run<kv_pair>(nw, n, seed, epochs, message);
+    if (kv_cfg().layout == KV_STRUCT)
+	return run<kv_struct>(nw, n, seed, epochs, message);
+    // comparisons of costly_int burn the requested amount of work
+    if (cmp_cost_enabled())
+	return run<costly_int>(nw, n, seed, epochs, message);
+    return run<int>(nw, n, seed, epochs, message);
 }
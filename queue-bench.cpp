@@ -0,0 +1,156 @@
+/* 
+ * Author: Lorenzo Beretta <lorenzo2beretta@gmail.com> 
+ * Date:   June 2020
+ */
+/*
+Throughput and latency benchmark of the queues used to hand work between
+threads: the mutex/condvar syque against the lock-free rings of ringq.hpp,
+whose consumers wait with each of the policies of wait.hpp.
+Throughput is measured with np producers and nc consumers moving n items
+each, latency as the round trip of a ping-pong between two threads.
+*/
+
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <string>
+#include <algorithm>
+#include "syque.hpp"
+#include "ringq.hpp"
+#include "utimer.hpp"
+
+const int CAPACITY = 1024;
+const int BATCH = 32;
+const int STOP = -1;  // items are non negative, this plays the role of EOS
+
+// single item push/pop
+template <typename Q>
+void put(Q &q, const int *x, int k) {
+    for (int i = 0; i < k; ++i) q.push(x[i]);
+}
+template <typename Q>
+int get(Q &q, int *x, int) {
+    x[0] = q.pop();
+    return 1;
+}
+
+// batched push/pop, only the rings have them
+template <typename Q>
+void put_batch(Q &q, const int *x, int k) {
+    q.push_batch(x, k);
+}
+template <typename Q>
+int get_batch(Q &q, int *x, int k) {
+    return q.pop_batch(x, k);
+}
+
+template <typename Q, typename P, typename G>
+void throughput(const std::string &name, Q &q, P put, G get, int np, int nc, long n, int batch) {
+    long us;
+    {
+	utimer timer(name + " throughput", &us);
+	std::vector<std::thread*> tids;
+	for (int t = 0; t < np; ++t)
+	    tids.push_back(new std::thread([&]() {
+		std::vector<int> buf(batch);
+		for (long i = 0; i < n; i += batch) {
+		    int k = std::min((long) batch, n - i);
+		    for (int j = 0; j < k; ++j) buf[j] = i + j;
+		    put(q, buf.data(), k);
+		}
+	    }));
+	std::vector<std::thread*> cons;
+	for (int t = 0; t < nc; ++t)
+	    cons.push_back(new std::thread([&]() {
+		std::vector<int> buf(batch);
+		while (true) {
+		    int k = get(q, buf.data(), batch);
+		    int stops = std::count(buf.begin(), buf.begin() + k, STOP);
+		    // a batch may steal the STOP of another consumer
+		    for (int s = STOP; stops > 1; --stops)
+			put(q, &s, 1);
+		    if (stops) return;
+		}
+	    }));
+	for (auto t : tids) { t->join(); delete t; }
+	// one STOP per consumer, each consumer leaves at the first it sees
+	for (int t = 0; t < nc; ++t) { int s = STOP; put(q, &s, 1); }
+	for (auto t : cons) { t->join(); delete t; }
+    }
+    std::cout << name << " throughput: " << (double) np * n / us << " Mitems/s\n";
+}
+
+template <typename Q>
+void latency(const std::string &name, Q &ping, Q &pong, long n) {
+    long us;
+    {
+	utimer timer(name + " latency", &us);
+	std::thread echo([&]() {
+	    for (long i = 0; i < n; ++i) pong.push(ping.pop());
+	});
+	for (long i = 0; i < n; ++i) {
+	    ping.push(i);
+	    pong.pop();
+	}
+	echo.join();
+    }
+    std::cout << name << " latency: " << 1000.0 * us / n << " nsec per round trip\n";
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 4) {
+	std::cerr << "use: " << argv[0]  << " nproducers nconsumers nitems\n";
+	return -1;
+    }
+ 
+    const int np = std::stol(argv[1]);
+    const int nc = std::stol(argv[2]);
+    const long n = std::stol(argv[3]);
+
+    {
+	syque<int> q;
+	throughput("syque", q, put<syque<int>>, get<syque<int>>, np, nc, n, 1);
+    }
+    for (wait_policy block : {WAIT_FUTEX, WAIT_BLOCK, WAIT_YIELD, WAIT_SPIN}) {
+	std::string mode = std::string(" (") + wait_name(block) + ")";
+	{
+	    mpmc_ring<int> q(CAPACITY, block);
+	    throughput("mpmc" + mode, q, put<mpmc_ring<int>>, get<mpmc_ring<int>>, np, nc, n, 1);
+	}
+	{
+	    mpmc_ring<int> q(CAPACITY, block);
+	    throughput("mpmc batched" + mode, q, put_batch<mpmc_ring<int>>,
+		       get_batch<mpmc_ring<int>>, np, nc, n, BATCH);
+	}
+	if (np == 1 && nc == 1) {
+	    {
+		spsc_ring<int> q(CAPACITY, block);
+		throughput("spsc" + mode, q, put<spsc_ring<int>>, get<spsc_ring<int>>, np, nc, n, 1);
+	    }
+	    {
+		spsc_ring<int> q(CAPACITY, block);
+		throughput("spsc batched" + mode, q, put_batch<spsc_ring<int>>,
+			   get_batch<spsc_ring<int>>, np, nc, n, BATCH);
+	    }
+	}
+    }
+
+    // a round trip each, so fewer iterations are enough
+    const long nl = std::max(1L, n / 100);
+    {
+	syque<int> ping, pong;
+	latency("syque", ping, pong, nl);
+    }
+    for (wait_policy block : {WAIT_FUTEX, WAIT_BLOCK, WAIT_YIELD, WAIT_SPIN}) {
+	std::string mode = std::string(" (") + wait_name(block) + ")";
+	{
+	    mpmc_ring<int> ping(CAPACITY, block), pong(CAPACITY, block);
+	    latency("mpmc" + mode, ping, pong, nl);
+	}
+	{
+	    spsc_ring<int> ping(CAPACITY, block), pong(CAPACITY, block);
+	    latency("spsc" + mode, ping, pong, nl);
+	}
+    }
+    return 0;
+}
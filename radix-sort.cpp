@@ -0,0 +1,185 @@
+/* 
+ * Author: Lorenzo Beretta <lorenzo2beretta@gmail.com> 
+ * Date:   June 2020
+ */
+/* 
+This is not odd-even sort: since every production binary sorts a vector of
+int, a comparison sort is not needed in the common case and we can use a
+parallel LSD radix sort, which is linear in n. Each of the 32 / BITS passes
+is made of three phases separated by a barrier:
+1. every thread builds the histogram of its own slice of the input,
+2. a parallel prefix sum turns the nw histograms into scatter offsets,
+3. every thread scatters its slice into the other (ping-pong) buffer
+   through write-combining buffers, one cache line per bucket.
+*/
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include "barrier.hpp"
+#include "wait.hpp"
+#include "utimer.hpp"
+
+// number of int fitting in a cache line
+const int WC_SIZE = 64 / sizeof(int);
+
+// signed keys are mapped to unsigned ones by flipping the sign bit,
+// so that the unsigned order on keys equals the signed order on values
+inline uint32_t key(int x) {
+    return (uint32_t) x ^ 0x80000000u;
+}
+
+template<int BITS>
+void radixsort_par(std::vector<int> &v, const int nw) {
+    const int R = 1 << BITS;  // number of buckets
+    const uint32_t mask = R - 1;
+    const int npass = (32 + BITS - 1) / BITS;
+    const size_t n = v.size();
+    std::vector<int> tmp(n);  // ping-pong buffer
+
+    // per-thread state is padded to a cache line to avoid false sharing:
+    // cnt[b] is the histogram of bucket b, then it becomes its offset
+    struct alignas(64) local_state {
+	size_t cnt[R];
+    };
+    std::vector<local_state> ls(nw);
+    // bucket ranges are split among threads for the prefix sum,
+    // tot[t] is the number of elements falling in the t-th range
+    struct alignas(64) padded_size {
+	size_t val;
+    };
+    std::vector<padded_size> tot(nw);
+    barrier bar(nw);
+
+    auto body = [&](int tid) {
+		    // input slice and bucket range owned by this thread
+		    const size_t lo = n * tid / nw;
+		    const size_t hi = n * (tid + 1) / nw;
+		    const int blo = R * tid / nw;
+		    const int bhi = R * (tid + 1) / nw;
+		    size_t *cnt = ls[tid].cnt;
+		    // write-combining buffers, flushed one cache line at a time
+		    std::vector<int> wc(R * WC_SIZE);
+		    std::vector<int> wcn(R);
+		    int *src = v.data();
+		    int *dst = tmp.data();
+
+		    for (int p = 0; p < npass; ++p) {
+			const int shift = p * BITS;
+			// histogram phase
+			std::fill(cnt, cnt + R, 0);
+			for (size_t i = lo; i < hi; ++i)
+			    cnt[(key(src[i]) >> shift) & mask]++;
+			bar.wait();
+
+			// prefix sum phase (first step): offsets inside
+			// the bucket range owned by this thread
+			size_t sum = 0;
+			for (int b = blo; b < bhi; ++b)
+			    for (int t = 0; t < nw; ++t) {
+				size_t c = ls[t].cnt[b];
+				ls[t].cnt[b] = sum;
+				sum += c;
+			    }
+			tot[tid].val = sum;
+			bar.wait();
+
+			// prefix sum phase (second step): shift by the number
+			// of elements falling in lower bucket ranges
+			size_t base = 0;
+			for (int t = 0; t < tid; ++t)
+			    base += tot[t].val;
+			for (int b = blo; b < bhi; ++b)
+			    for (int t = 0; t < nw; ++t)
+				ls[t].cnt[b] += base;
+			bar.wait();
+
+			// scatter phase
+			std::fill(wcn.begin(), wcn.end(), 0);
+			for (size_t i = lo; i < hi; ++i) {
+			    int b = (key(src[i]) >> shift) & mask;
+			    int *buf = &wc[b * WC_SIZE];
+			    buf[wcn[b]++] = src[i];
+			    if (wcn[b] == WC_SIZE) {
+				std::memcpy(dst + cnt[b], buf, sizeof(buf[0]) * WC_SIZE);
+				cnt[b] += WC_SIZE;
+				wcn[b] = 0;
+			    }
+			}
+			for (int b = 0; b < R; ++b) {
+			    std::memcpy(dst + cnt[b], &wc[b * WC_SIZE], sizeof(int) * wcn[b]);
+			    cnt[b] += wcn[b];
+			}
+			std::swap(src, dst);
+			// nobody reads src before everybody wrote dst
+			bar.wait();
+		    }
+		};
+
+    // spawn threads
+    std::vector<std::thread*> tids(nw);
+    for (int i = 0; i < nw; ++i)
+	tids[i] = new std::thread(body, i);
+    // join threads and destruct thread objects
+    for (int i = 0; i < nw; ++i) {
+	tids[i]->join();
+	delete tids[i];
+    }
+
+    // after an odd number of passes the result lies in the ping-pong buffer
+    if (npass & 1)
+	v.swap(tmp);
+}
+
+int main(int argc, char* argv[]) {
+    // radix sort never compares keys, so the synthetic comparison cost
+    // of the other engines has nothing to slow down
+    for (int i = 1; i < argc; ++i)
+	if (std::string(argv[i]).rfind("--cmp-", 0) == 0) {
+	    std::cerr << argv[i] << " does not apply to radix sort\n";
+	    return -1;
+	}
+    if (!wait_args(argc, argv) || argc < 4) {
+	std::cerr << "use: " << argv[0];
+	std::cerr << " nworkers vector-length seed [digit-bits (8 or 11)]";
+	std::cerr << " [--wait=spin|yield|futex|block]\n";
+	return -1;
+    }
+ 
+    const int nw = std::stol(argv[1]);
+    const int n = std::stol(argv[2]);
+    const int seed = std::stol(argv[3]);
+    const int bits = (argc == 5) ? std::stol(argv[4]) : 8;
+    if (bits != 8 && bits != 11) {
+	std::cerr << "digit-bits must be either 8 or 11\n";
+	return -1;
+    }
+    // seed allows to set up fair experiments
+    srand(seed);
+    std::vector<int> v(n);
+    for (auto &z : v) z = rand();
+    // writing a message, a useful log for managing experiments
+    std::string message = argv[0];
+    for (int i = 1; i < argc; ++i)
+	message += ' ' + std::string(argv[i]);
+    message += wait_describe();
+    
+    {
+	utimer timer(message);
+	if (bits == 8)
+	    radixsort_par<8>(v, nw);
+	else
+	    radixsort_par<11>(v, nw);
+    }
+
+    // check that the algorithm is correct
+    if (!std::is_sorted(v.begin(), v.end())) {
+	std::cout << "VECTOR IS NOT SORTED!" << std::endl;
+	return -1;
+    }
+    wait_report();
+    return 0;
+}
@@ -0,0 +1,203 @@
+#pragma once
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <cstddef>
+#include "wait.hpp"
+
+//
+// lock-free bounded ring buffers, with the same push/pop interface of syque:
+// spsc_ring<T> for one producer and one consumer, mpmc_ring<T> for any
+// number of both (Vyukov's bounded queue). Head and tail live on different
+// cache lines, and an empty ring makes pop wait with the policy given to
+// the constructor (wait.hpp), by default spinning for a while and then
+// sleeping on a futex. A full ring makes push spin (yielding), since
+// bounded queues are sized by the caller so that this does not happen
+// in the common case.
+//
+
+template <typename T>
+class spsc_ring
+{
+private:
+  const size_t          d_mask;
+  std::vector<T>        d_buf;
+  // consumer side
+  alignas(64) std::atomic<size_t> d_head{0};
+  size_t                d_tail_cache = 0;
+  // producer side
+  alignas(64) std::atomic<size_t> d_tail{0};
+  size_t                d_head_cache = 0;
+  alignas(64) wait_point d_waiter;
+
+  static size_t pow2(size_t n) { size_t c = 2; while (c < n) c <<= 1; return c; }
+
+public:
+
+  spsc_ring(size_t capacity, wait_policy policy = WAIT_FUTEX)
+    : d_mask(pow2(capacity) - 1), d_buf(d_mask + 1), d_waiter(policy) {}
+
+  // push up to n items, returns how many were pushed
+  size_t try_push_batch(T const* values, size_t n) {
+    size_t tail = this->d_tail.load(std::memory_order_relaxed);
+    if (tail + n - this->d_head_cache > this->d_mask + 1)
+      this->d_head_cache = this->d_head.load(std::memory_order_acquire);
+    size_t room = this->d_mask + 1 - (tail - this->d_head_cache);
+    if (n > room) n = room;
+    for (size_t i = 0; i < n; ++i)
+      this->d_buf[(tail + i) & this->d_mask] = values[i];
+    if (n > 0) {
+      this->d_tail.store(tail + n, std::memory_order_seq_cst);
+      this->d_waiter.notify();
+    }
+    return n;
+  }
+
+  // pop up to n items, returns how many were popped
+  size_t try_pop_batch(T* values, size_t n) {
+    size_t head = this->d_head.load(std::memory_order_relaxed);
+    if (this->d_tail_cache - head < n)
+      this->d_tail_cache = this->d_tail.load(std::memory_order_acquire);
+    size_t avail = this->d_tail_cache - head;
+    if (n > avail) n = avail;
+    for (size_t i = 0; i < n; ++i)
+      values[i] = std::move(this->d_buf[(head + i) & this->d_mask]);
+    if (n > 0)
+      this->d_head.store(head + n, std::memory_order_release);
+    return n;
+  }
+
+  bool try_push(T const& value) { return try_push_batch(&value, 1) == 1; }
+  bool try_pop(T& value) { return try_pop_batch(&value, 1) == 1; }
+
+  void push_batch(T const* values, size_t n) {
+    while (n > 0) {
+      size_t k = try_push_batch(values, n);
+      if (k == 0) std::this_thread::yield();
+      values += k;
+      n -= k;
+    }
+  }
+
+  // wait until at least one item is available, then take up to n of them
+  size_t pop_batch(T* values, size_t n) {
+    size_t k;
+    this->d_waiter.wait([&]{ return (k = try_pop_batch(values, n)) > 0; });
+    return k;
+  }
+
+  void push(T const& value) { push_batch(&value, 1); }
+
+  T pop() {
+    T rc;
+    pop_batch(&rc, 1);
+    return rc;
+  }
+};
+
+template <typename T>
+class mpmc_ring
+{
+private:
+  struct cell {
+    std::atomic<size_t> seq;
+    T                   data;
+  };
+  const size_t          d_mask;
+  std::vector<cell>     d_buf;
+  alignas(64) std::atomic<size_t> d_enqueue{0};
+  alignas(64) std::atomic<size_t> d_dequeue{0};
+  alignas(64) wait_point d_waiter;
+
+  static size_t pow2(size_t n) { size_t c = 2; while (c < n) c <<= 1; return c; }
+
+public:
+
+  mpmc_ring(size_t capacity, wait_policy policy = WAIT_FUTEX)
+    : d_mask(pow2(capacity) - 1), d_buf(d_mask + 1), d_waiter(policy) {
+    for (size_t i = 0; i <= this->d_mask; ++i)
+      this->d_buf[i].seq.store(i, std::memory_order_relaxed);
+  }
+
+  bool try_push(T const& value) {
+    size_t pos = this->d_enqueue.load(std::memory_order_relaxed);
+    cell* c;
+    while (true) {
+      c = &this->d_buf[pos & this->d_mask];
+      size_t seq = c->seq.load(std::memory_order_acquire);
+      long dif = (long) seq - (long) pos;
+      if (dif == 0) {
+        if (this->d_enqueue.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+          break;
+      }
+      else if (dif < 0)
+        return false;  // full
+      else
+        pos = this->d_enqueue.load(std::memory_order_relaxed);
+    }
+    c->data = value;
+    c->seq.store(pos + 1, std::memory_order_seq_cst);
+    this->d_waiter.notify();
+    return true;
+  }
+
+  bool try_pop(T& value) {
+    size_t pos = this->d_dequeue.load(std::memory_order_relaxed);
+    cell* c;
+    while (true) {
+      c = &this->d_buf[pos & this->d_mask];
+      size_t seq = c->seq.load(std::memory_order_acquire);
+      long dif = (long) seq - (long) (pos + 1);
+      if (dif == 0) {
+        if (this->d_dequeue.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+          break;
+      }
+      else if (dif < 0)
+        return false;  // empty
+      else
+        pos = this->d_dequeue.load(std::memory_order_relaxed);
+    }
+    value = std::move(c->data);
+    c->seq.store(pos + this->d_mask + 1, std::memory_order_release);
+    return true;
+  }
+
+  // push up to n items, returns how many were pushed
+  size_t try_push_batch(T const* values, size_t n) {
+    size_t k = 0;
+    while (k < n && try_push(values[k])) ++k;
+    return k;
+  }
+
+  // pop up to n items, returns how many were popped
+  size_t try_pop_batch(T* values, size_t n) {
+    size_t k = 0;
+    while (k < n && try_pop(values[k])) ++k;
+    return k;
+  }
+
+  void push_batch(T const* values, size_t n) {
+    while (n > 0) {
+      size_t k = try_push_batch(values, n);
+      if (k == 0) std::this_thread::yield();
+      values += k;
+      n -= k;
+    }
+  }
+
+  // wait until at least one item is available, then take up to n of them
+  size_t pop_batch(T* values, size_t n) {
+    size_t k;
+    this->d_waiter.wait([&]{ return (k = try_pop_batch(values, n)) > 0; });
+    return k;
+  }
+
+  void push(T const& value) { push_batch(&value, 1); }
+
+  T pop() {
+    T rc;
+    pop_batch(&rc, 1);
+    return rc;
+  }
+};
@@ -0,0 +1,168 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <cstdlib>
+#include <unistd.h>
+#include "fill.hpp"
+
+//
+// roofline report of a run. An odd-even pass is a streaming scan doing
+// one comparison every two elements, so once the chunks stop fitting in
+// cache the memory system, not the comparisons, sets the pace. Engines
+// account the bytes they move between memory and the cores, and the
+// report compares the achieved bandwidth with two ceilings measured on
+// the spot with the same number of threads: a STREAM triad (memory) and
+// passes over blocks resident in L1 (compute).
+// It is enabled by --roofline and printed on stderr after the run, so
+// that the timing line stays the same.
+//
+
+struct traffic {
+  double elem_passes = 0;  // elements covered by the passes, summed over passes
+  double bytes = 0;        // bytes moved between memory and the cores
+  // passes over m elements of s bytes load and store each of them once
+  void pass(double m, size_t s, double times = 1) {
+    elem_passes += m * times;
+    bytes += 2 * m * s * times;
+  }
+  traffic& operator+=(const traffic& o) {
+    elem_passes += o.elem_passes;
+    bytes += o.bytes;
+    return *this;
+  }
+};
+
+inline bool& roofline_enabled() {
+  static bool on = false;
+  return on;
+}
+
+// strip --roofline from the command line
+inline void roofline_args(int& argc, char* argv[]) {
+  int k = 1;
+  for (int i = 1; i < argc; ++i)
+    if (std::string(argv[i]) == "--roofline")
+      roofline_enabled() = true;
+    else
+      argv[k++] = argv[i];
+  argc = k;
+}
+
+inline long last_level_cache() {
+  long llc = sysconf(_SC_LEVEL3_CACHE_SIZE);
+  if (llc <= 0) llc = sysconf(_SC_LEVEL2_CACHE_SIZE);
+  return (llc > 0) ? llc : 32L << 20;
+}
+
+// run f(tid) on nw threads, returns the elapsed seconds
+template<typename F>
+double roofline_parallel(int nw, F f) {
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> tids;
+  for (int i = 0; i < nw; ++i)
+    tids.emplace_back(f, i);
+  for (auto& t : tids)
+    t.join();
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// STREAM triad a = b + s * c over arrays 4 times larger than the
+// last-level cache altogether, best of 5 runs, in GB/s
+inline double stream_bandwidth(int nw) {
+  const long m = std::max(last_level_cache() * 4, 96L << 20) / 3 / sizeof(double);
+  std::vector<double> a(m), b(m), c(m);
+  auto slice = [&](int tid, long& lo, long& hi) {
+    lo = m * tid / nw;
+    hi = m * (tid + 1) / nw;
+  };
+  // first touch by the thread that will use the pages
+  roofline_parallel(nw, [&](int tid) {
+    long lo, hi;
+    slice(tid, lo, hi);
+    std::fill(a.begin() + lo, a.begin() + hi, 0.0);
+    std::fill(b.begin() + lo, b.begin() + hi, 1.0);
+    std::fill(c.begin() + lo, c.begin() + hi, 2.0);
+  });
+  double best = 1e30;
+  for (int r = 0; r < 5; ++r)
+    best = std::min(best, roofline_parallel(nw, [&](int tid) {
+      long lo, hi;
+      slice(tid, lo, hi);
+      for (long i = lo; i < hi; ++i)
+        a[i] = b[i] + 3.0 * c[i];
+    }));
+  return 3.0 * m * sizeof(double) / best / 1e9;
+}
+
+// passes over blocks of 16 KB of T, one per thread, for about 100 ms,
+// in GB/s of pass traffic: the rate the engines would reach if memory
+// were free
+template<typename T>
+double cache_pass_rate(int nw) {
+  const long m = (16 << 10) / sizeof(T);
+  const int passes = 32;
+  std::vector<T> orig(m);
+  fill_random(orig);
+  std::vector<long> rounds(nw);
+  double sec = roofline_parallel(nw, [&](int tid) {
+    std::vector<T> blk(m);
+    auto start = std::chrono::steady_clock::now();
+    do {
+      // start again from random data, a sorted block never swaps
+      std::copy(orig.begin(), orig.end(), blk.begin());
+      for (int p = 0; p < passes; ++p)
+        for (long j = p & 1; j + 1 < m; j += 2)
+          if (blk[j + 1] < blk[j])
+            std::swap(blk[j + 1], blk[j]);
+      ++rounds[tid];
+    } while (std::chrono::steady_clock::now() - start < std::chrono::milliseconds(100));
+  });
+  traffic t;
+  for (long r : rounds)
+    t.pass(m, sizeof(T), (double) r * passes);
+  return t.bytes / sec / 1e9;
+}
+
+// the ceilings bound the running time from below: moving the bytes
+// at the STREAM rate, and performing the passes at the in-cache rate
+template<typename T>
+void roofline_report(const traffic& t, long n, long usec, int nw) {
+  const double gb = 1e9, kb = 1 << 10, mb = 1 << 20;
+  const double sec = usec * 1e-6;
+  const double passes = t.elem_passes / n;
+  const double work = 2 * t.elem_passes * sizeof(T);  // bytes the passes scan
+  const double ws = (double) n * sizeof(T);
+  const long llc = last_level_cache();
+  const double mem = stream_bandwidth(nw);
+  const double cpu = cache_pass_rate<T>(nw);
+  std::ostream& os = std::cerr;
+  os.setf(std::ios::fixed);
+  os.precision(2);
+  os << "roofline: " << passes << " passes, " << t.bytes / std::max(passes, 1.0) / kb
+     << " KiB moved per pass, " << t.bytes / gb << " GB moved, "
+     << t.bytes / sec / gb << " GB/s achieved\n";
+  os << "roofline: working set " << ws / mb << " MiB, last-level cache " << llc / mb << " MiB\n";
+  os << "roofline: memory ceiling (STREAM triad) " << mem << " GB/s, "
+     << 100 * t.bytes / sec / gb / mem << "% reached\n";
+  os << "roofline: compute ceiling (passes in L1) " << cpu << " GB/s of passes, "
+     << 100 * work / sec / gb / cpu << "% reached\n";
+  // a working set held by the last-level cache never reaches DRAM
+  const double mem_sec = (ws > llc) ? t.bytes / gb / mem : 0;
+  const double cpu_sec = work / gb / cpu;
+  const bool memory_bound = mem_sec > cpu_sec;
+  os << "roofline: " << (memory_bound ? "bandwidth-bound" : "compute-bound");
+  if (memory_bound)
+    os << ", more workers will not help: cut the traffic (more passes per load)";
+  else
+    os << ", vectorizing the passes or adding workers raises the ceiling";
+  const double used = std::max(mem_sec, cpu_sec) / sec;
+  if (used < 0.5)
+    os << "; synchronization or load imbalance leave "
+       << 100 - 100 * used << "% of the time unexplained";
+  os << '\n';
+}
@@ -8,17 +8,24 @@
 #include <iostream>
 #include <vector>
 #include <algorithm>
-#include <cassert>
+#include "cmpcost.hpp"
+#include "roofline.hpp"
+#include "strkey.hpp"
+#include "kvpair.hpp"
+#include "topk.hpp"
 #include "utimer.hpp"
 
 // This function sorts a vector of T-type elements, where T is
 // a type for which the order operator < is defined using odd-even sort.
+// It returns the memory traffic of the passes.
 template<typename T>
-void oesort_seq(std::vector<T> &v) {
+traffic oesort_seq(std::vector<T> &v) {
     size_t n = v.size();
     bool sorted = false;
+    traffic t;
     while (!sorted) {
 	sorted = true;
+	t.pass(n, sizeof(T), 2);
 	// odd phase
 	for (int i = 1; i < n - 1; i += 2) {
 	    if (v[i + 1] < v[i]) {
@@ -34,29 +41,87 @@ void oesort_seq(std::vector<T> &v) {
 	    }
 	}
     }
+    return t;
+}
+
+// fill, sort and check a vector of T
+template<typename T>
+int run(const int n, const int seed, const std::string &message) {
+    // seed allows to set up fair experiments
+    srand(seed);
+    std::vector<T> v(n);
+    fill_random(v);
+    // in top-k mode only the k smallest elements are sorted
+    std::vector<T> input;
+    if (topk_enabled())
+	input = v;
+    
+    traffic t;
+    long usec;
+    {
+	utimer timer(message, &usec);
+	if (topk_enabled())
+	    v = topk_select(v, topk_cfg().k, 1);
+	t = oesort_seq<T>(v);
+	// wide payloads follow their keys
+	kv_finish(v, 1);
+    }
+
+    // check that the algorithm is correct
+    if (!std::is_sorted(v.begin(), v.end())) {
+	std::cout << "VECTOR IS NOT SORTED!" << std::endl;
+	return -1;
+    }
+    if (topk_enabled() && !topk_check(input, v)) {
+	std::cout << "NOT THE TOP " << topk_cfg().k << "!" << std::endl;
+	return -1;
+    }
+    if (!kv_check(v)) {
+	std::cout << "PAIRS TORN APART!" << std::endl;
+	return -1;
+    }
+    if (roofline_enabled())
+	roofline_report<T>(t, v.size(), usec, 1);
+    return 0;
 }
 
 int main(int argc, char* argv[]) {
-    if (argc < 3) {
-        std::cerr << "use: " << argv[0]  << " vector-length seed\n";
+    roofline_args(argc, argv);
+    if (!string_args(argc, argv) || !kv_args(argc, argv) || !cmp_cost_args(argc, argv) ||
+	!topk_args(argc, argv) || argc < 3) {
+        std::cerr << "use: " << argv[0]  << " vector-length seed";
+	std::cerr << " [--strings=8|16] [--kv[=packed|struct] [--kv-payload=bytes]] [--top-k=k]";
+	std::cerr << " [--cmp-cost=ns] [--cmp-class=compute|memory] [--roofline]\n";
         return -1;
     }
  
+    if (kv_enabled() && (string_cfg().prefix != 0 || cmp_cost_enabled())) {
+	std::cerr << "--kv sorts integer keys\n";
+	return -1;
+    }
+ 
     int n = std::stol(argv[1]);
     int seed = std::stol(argv[2]);
-    // seed allows to set up fair experiments
-    srand(seed);
-    std::vector<int> v(n);
-    for (auto &z : v) z = rand();
     std::string message = argv[0];
     for (int i = 1; i < argc; ++i)
 	message += ' ' + std::string(argv[i]);
+    message += string_describe();
+    message += kv_describe();
+    message += topk_describe();
+    message += cmp_cost_describe();
     
-    {
-	utimer timer(message);
-	oesort_seq<int>(v);
-    }
-
-    assert(std::is_sorted(v.begin(), v.end()));
-    return 0;
+    // string handles carry a prefix of 8 or 16 bytes
+    if (string_cfg().prefix == 8)
+	return run<str_handle<8>>(n, seed, message);
+    if (string_cfg().prefix == 16)
+	return run<str_handle<16>>(n, seed, message);
+    // pairs packed in a word or in a struct
+    if (kv_cfg().layout == KV_PACKED)
+	return run<kv_pair>(n, seed, message);
+    if (kv_cfg().layout == KV_STRUCT)
+	return run<kv_struct>(n, seed, message);
+    // comparisons of costly_int burn the requested amount of work
+    if (cmp_cost_enabled())
+	return run<costly_int>(n, seed, message);
+    return run<int>(n, seed, message);
 }
@@ -0,0 +1,512 @@
+/*
+ * Author: Lorenzo Beretta <lorenzo2beretta@gmail.com>
+ * Date:   June 2020
+ */
+/*
+A local sort service. Every other program of this folder is a fresh
+process that spawns its threads for a single sort, which costs more than
+the sort itself when vectors are small. The server keeps a pool of
+workers alive and accepts jobs over a Unix domain socket (SOCK_SEQPACKET,
+so that every request and reply is one message); a client does not send
+its data but a memfd holding it, passed as SCM_RIGHTS ancillary data:
+the server maps it, sorts it in place and replies when it is done, so
+that the vector is never copied. The memfd must be sealed against
+shrinking (F_SEAL_SHRINK), or a client truncating it under the server
+would kill it with SIGBUS on the next access to the mapping.
+
+Two engines are resident:
+- seq, the loop of oesort_seq on the SIMD pass of kernels.hpp, run by a
+  single worker, so that many small jobs are sorted side by side,
+- par, the block version of pthread-barrier.cpp run by the whole pool
+  as a gang: the job is queued once per worker, and since the queue is
+  FIFO the gang always forms, whatever the other workers are doing.
+auto picks seq below PAR_MIN elements and par above.
+
+Admission control bounds the jobs and the elements admitted and not yet
+sorted: a job beyond the bounds is rejected at once, and the client
+retries later, unless it has more elements than the bound, which it
+could never fit in: such a job fails, and the client gives up. Every reply carries the statistics of its job (time spent
+queued, time spent sorting, passes and workers), and the server prints
+a summary when it is stopped.
+*/
+
+#include <iostream>
+#include <vector>
+#include <deque>
+#include <string>
+#include <memory>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstring>
+#include <unistd.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "barrier.hpp"
+#include "kernels.hpp"
+#include "wait.hpp"
+#include "utimer.hpp"
+
+using hrc = std::chrono::steady_clock;
+
+const long PAR_MIN = 1 << 14;
+
+enum { SORT = 1, STOP = 2 };
+enum { ENGINE_AUTO, ENGINE_SEQ, ENGINE_PAR };
+enum { DONE, REJECTED, FAILED };
+const char *engine_name[] = {"auto", "seq", "par"};
+
+// a request carries the memfd of the vector if op == SORT
+struct request {
+    int op;
+    int engine;
+    long n;
+};
+
+struct reply {
+    int status;
+    int engine;      // the one that ran
+    int workers;
+    long passes;
+    long wait_usec;  // from admission to the start of the sort
+    long sort_usec;
+};
+
+void die(const std::string &what) {
+    perror(what.c_str());
+    exit(-1);
+}
+
+long usec_since(hrc::time_point t) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(hrc::now() - t).count();
+}
+
+// one message with fd attached, unless fd < 0
+bool send_msg(int sock, const void *buf, size_t len, int fd) {
+    iovec iov = {(void *) buf, len};
+    msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    char ctl[CMSG_SPACE(sizeof(int))] = {};
+    if (fd >= 0) {
+	msg.msg_control = ctl;
+	msg.msg_controllen = sizeof(ctl);
+	cmsghdr *c = CMSG_FIRSTHDR(&msg);
+	c->cmsg_level = SOL_SOCKET;
+	c->cmsg_type = SCM_RIGHTS;
+	c->cmsg_len = CMSG_LEN(sizeof(int));
+	std::memcpy(CMSG_DATA(c), &fd, sizeof(int));
+    }
+    return sendmsg(sock, &msg, MSG_NOSIGNAL) == (ssize_t) len;
+}
+
+// returns the length of the message, 0 at end of file; *fd is the
+// descriptor attached to it or -1
+ssize_t recv_msg(int sock, void *buf, size_t len, int *fd) {
+    iovec iov = {buf, len};
+    msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    char ctl[CMSG_SPACE(sizeof(int))];
+    msg.msg_control = ctl;
+    msg.msg_controllen = sizeof(ctl);
+    ssize_t k = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    *fd = -1;
+    if (k > 0)
+	for (cmsghdr *c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c))
+	    if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS)
+		std::memcpy(fd, CMSG_DATA(c), sizeof(int));
+    return k;
+}
+
+sockaddr_un socket_address(const std::string &path) {
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+	std::cerr << "socket path too long\n";
+	exit(-1);
+    }
+    std::strcpy(addr.sun_path, path.c_str());
+    return addr;
+}
+
+// ---------------------------- SERVER -------------------------------
+
+// the descriptor is closed once the client hung up and no job of it
+// is left to reply to, so that it cannot be reused under their feet
+struct connection {
+    const int fd;
+    connection(int fd): fd(fd) {}
+    ~connection() { close(fd); }
+};
+
+struct job {
+    std::shared_ptr<connection> conn;
+    int *v;
+    long n;
+    size_t map_len;
+    int engine;
+    int workers = 1;
+    hrc::time_point admitted, started;
+    long wait_usec = 0;
+    long passes = 0;
+    // the gang of the par engine: changed[p % 3] tells whether pass p
+    // swapped something, the leader clears the flag of pass p + 1 during
+    // pass p, when everybody has read it already
+    std::unique_ptr<barrier> bar;
+    std::atomic<int> changed[3];
+    std::atomic<int> running{0};
+};
+
+class sort_service {
+    const int nw;
+    const int max_jobs;
+    const long max_elems;
+    std::mutex mtx;
+    std::condition_variable cv;
+    // the jobs and the rank in their gang
+    std::deque<std::pair<std::shared_ptr<job>, int>> queue;
+    int jobs_in = 0;
+    long elems_in = 0;
+    bool shutdown = false;
+    // totals for the summary
+    long served = 0, rejected = 0, tot_wait = 0, tot_sort = 0;
+    std::vector<std::thread> pool;
+
+    void sort_seq(job &j) {
+	int *v = j.v;
+	while (pass_simd(v, 0, j.n, 1) | pass_simd(v, 0, j.n, 0))
+	    j.passes += 2;
+	j.passes += 2;
+    }
+
+    // the block of rank r in a gang of nw workers, as in pthread-barrier
+    void sort_member(job &j, int r) {
+	const long st = j.n * r / nw;
+	const long en = std::min(j.n, j.n * (r + 1) / nw + 1);
+	int clean = 0;
+	for (long p = 0; clean < 2; ++p) {
+	    if (pass_simd(j.v, st, en, (p & 1) ? 0 : 1))
+		j.changed[p % 3] = 1;
+	    if (r == 0)
+		j.changed[(p + 1) % 3] = 0;
+	    j.bar->wait();
+	    clean = j.changed[p % 3] ? 0 : clean + 1;
+	    if (r == 0)
+		j.passes = p + 1;
+	}
+    }
+
+    void complete(job &j) {
+	const long sort_usec = usec_since(j.started);
+	reply rep = {DONE, j.engine, j.workers, j.passes, j.wait_usec, sort_usec};
+	munmap(j.v, j.map_len);
+	// the client may be gone, then nobody needs the reply
+	send_msg(j.conn->fd, &rep, sizeof(rep), -1);
+	std::lock_guard<std::mutex> lk(mtx);
+	--jobs_in;
+	elems_in -= j.n;
+	++served;
+	tot_wait += j.wait_usec;
+	tot_sort += sort_usec;
+    }
+
+    void worker() {
+	std::unique_lock<std::mutex> lk(mtx);
+	while (true) {
+	    cv.wait(lk, [&]{ return shutdown || !queue.empty(); });
+	    if (queue.empty())
+		return;
+	    auto [j, r] = queue.front();
+	    queue.pop_front();
+	    lk.unlock();
+	    if (j->running++ == 0) {
+		j->started = hrc::now();
+		j->wait_usec = usec_since(j->admitted);
+	    }
+	    if (j->engine == ENGINE_SEQ)
+		sort_seq(*j);
+	    else
+		sort_member(*j, r);
+	    // the last member of a gang replies
+	    if (--j->running == 0)
+		complete(*j);
+	    lk.lock();
+	}
+    }
+
+public:
+    sort_service(int nw, int max_jobs, long max_elems):
+	nw(nw), max_jobs(max_jobs), max_elems(max_elems) {
+	for (int i = 0; i < nw; ++i)
+	    pool.emplace_back([this]{ worker(); });
+    }
+
+    // queue j or reject it if it would exceed the bounds
+    bool admit(std::shared_ptr<job> j) {
+	std::lock_guard<std::mutex> lk(mtx);
+	if (jobs_in + 1 > max_jobs || elems_in + j->n > max_elems) {
+	    ++rejected;
+	    return false;
+	}
+	++jobs_in;
+	elems_in += j->n;
+	j->admitted = hrc::now();
+	if (j->engine == ENGINE_AUTO)
+	    j->engine = (j->n < PAR_MIN) ? ENGINE_SEQ : ENGINE_PAR;
+	if (j->engine == ENGINE_PAR && (nw == 1 || j->n < 2 * nw))
+	    j->engine = ENGINE_SEQ;
+	if (j->engine == ENGINE_SEQ)
+	    queue.push_back({j, 0});
+	else {
+	    j->workers = nw;
+	    j->bar.reset(new barrier(nw));
+	    for (auto &c : j->changed) c = 0;
+	    for (int r = 0; r < nw; ++r)
+		queue.push_back({j, r});
+	}
+	cv.notify_all();
+	return true;
+    }
+
+    // sort what was admitted, then stop the workers
+    ~sort_service() {
+	{
+	    std::lock_guard<std::mutex> lk(mtx);
+	    shutdown = true;
+	}
+	cv.notify_all();
+	for (auto &t : pool)
+	    t.join();
+	std::cerr << "served " << served << " jobs, rejected " << rejected;
+	if (served > 0)
+	    std::cerr << ", " << tot_wait / served << " usec queued and "
+		      << tot_sort / served << " usec sorting on average";
+	std::cerr << '\n';
+	wait_report();
+    }
+};
+
+// whether the memfd fd cannot shrink under the mapping of a job
+bool shrink_sealed(int fd) {
+    int seals = fcntl(fd, F_GET_SEALS);
+    return seals >= 0 && (seals & F_SEAL_SHRINK);
+}
+
+int serve(const std::string &path, int nw, int max_jobs, long max_elems) {
+    int ls = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    sockaddr_un addr = socket_address(path);
+    unlink(path.c_str());
+    if (ls < 0 || bind(ls, (sockaddr *) &addr, sizeof(addr)) < 0 || listen(ls, 64) < 0)
+	die("listen");
+    sort_service service(nw, max_jobs, max_elems);
+    std::cerr << "serving on " << path << " with " << nw << " workers\n";
+
+    std::vector<std::shared_ptr<connection>> conns;
+    bool stop = false;
+    while (!stop) {
+	std::vector<pollfd> pfd = {{ls, POLLIN, 0}};
+	for (auto &c : conns)
+	    pfd.push_back({c->fd, POLLIN, 0});
+	if (poll(pfd.data(), pfd.size(), -1) < 0)
+	    die("poll");
+	for (size_t i = pfd.size() - 1; i > 0; --i) {
+	    if (!pfd[i].revents)
+		continue;
+	    auto conn = conns[i - 1];
+	    request req;
+	    int fd;
+	    ssize_t k = recv_msg(conn->fd, &req, sizeof(req), &fd);
+	    if (k <= 0) {
+		// hung up, jobs still queued keep the connection alive
+		conns.erase(conns.begin() + (i - 1));
+		continue;
+	    }
+	    reply rep = {FAILED, 0, 0, 0, 0, 0};
+	    bool queued = false;
+	    if (k == sizeof(req) && req.op == STOP) {
+		rep.status = DONE;
+		stop = true;
+	    }
+	    else if (k == sizeof(req) && req.op == SORT && fd >= 0 && req.n >= 0 &&
+		     req.n <= max_elems && req.engine >= ENGINE_AUTO && req.engine <= ENGINE_PAR &&
+		     shrink_sealed(fd)) {
+		struct stat sb;
+		auto j = std::make_shared<job>();
+		j->conn = conn;
+		j->n = req.n;
+		j->engine = req.engine;
+		j->map_len = std::max<size_t>(1, req.n * sizeof(int));
+		j->v = (fstat(fd, &sb) < 0 || (size_t) sb.st_size < req.n * sizeof(int)) ?
+		    (int *) MAP_FAILED :
+		    (int *) mmap(NULL, j->map_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (j->v != MAP_FAILED) {
+		    // the worker completing the job replies
+		    queued = service.admit(j);
+		    if (!queued) {
+			munmap(j->v, j->map_len);
+			rep.status = REJECTED;
+		    }
+		}
+	    }
+	    if (fd >= 0)
+		close(fd);
+	    if (!queued)
+		send_msg(conn->fd, &rep, sizeof(rep), -1);
+	}
+	if (pfd[0].revents) {
+	    int c = accept4(ls, NULL, NULL, SOCK_CLOEXEC);
+	    if (c < 0) die("accept");
+	    conns.push_back(std::make_shared<connection>(c));
+	}
+    }
+    close(ls);
+    unlink(path.c_str());
+    return 0;
+}
+
+// ---------------------------- CLIENT -------------------------------
+
+int connect_to(const std::string &path) {
+    int s = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    sockaddr_un addr = socket_address(path);
+    if (s < 0 || connect(s, (sockaddr *) &addr, sizeof(addr)) < 0)
+	die("connect to " + path);
+    return s;
+}
+
+// send one request and wait for its reply
+reply call(int s, const request &req, int fd) {
+    reply rep;
+    int none;
+    if (!send_msg(s, &req, sizeof(req), fd) ||
+	recv_msg(s, &rep, sizeof(rep), &none) != sizeof(rep))
+	die("sort service");
+    return rep;
+}
+
+// client threads, each submitting jobs vectors of n ints one after the
+// other from its own memfd, checking them and timing the round trips
+int submit(const std::string &path, long n, int seed, int jobs, int clients, int engine,
+	   const std::string &message) {
+    std::vector<std::vector<long>> rtt(clients);
+    std::vector<reply> last(clients);
+    std::atomic<long> retries{0}, passes{0}, wait{0}, sorting{0};
+    std::atomic<bool> failed{false}, refused{false};
+    {
+	utimer timer(message);
+	std::vector<std::thread> tids;
+	for (int c = 0; c < clients; ++c)
+	    tids.emplace_back([&, c]() {
+		int s = connect_to(path);
+		int fd = memfd_create("sort-job", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+		if (fd < 0 || ftruncate(fd, std::max<size_t>(1, n * sizeof(int))) < 0 ||
+		    fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK) < 0)
+		    die("memfd");
+		int *v = (int *) mmap(NULL, std::max<size_t>(1, n * sizeof(int)),
+				      PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (v == MAP_FAILED) die("mmap");
+		unsigned int r = seed + c;
+		for (int j = 0; j < jobs; ++j) {
+		    for (long i = 0; i < n; ++i) v[i] = rand_r(&r);
+		    auto start = hrc::now();
+		    reply rep;
+		    // back off exponentially while the server is full
+		    for (long backoff = 50; (rep = call(s, {SORT, engine, n}, fd)).status == REJECTED;
+			 backoff = std::min(2 * backoff, 10000L)) {
+			++retries;
+			std::this_thread::sleep_for(std::chrono::microseconds(backoff));
+		    }
+		    // a job the server can never take is not submitted again
+		    if (rep.status == FAILED) {
+			refused = true;
+			break;
+		    }
+		    rtt[c].push_back(usec_since(start));
+		    if (rep.status != DONE || !std::is_sorted(v, v + n))
+			failed = true;
+		    passes += rep.passes;
+		    wait += rep.wait_usec;
+		    sorting += rep.sort_usec;
+		    last[c] = rep;
+		}
+		munmap(v, std::max<size_t>(1, n * sizeof(int)));
+		close(fd);
+		close(s);
+	    });
+	for (auto &t : tids)
+	    t.join();
+    }
+    if (refused) {
+	std::cout << "JOB FAILED!" << std::endl;
+	return -1;
+    }
+    if (failed) {
+	std::cout << "VECTOR IS NOT SORTED!" << std::endl;
+	return -1;
+    }
+    // statistics go to stderr, leaving the timing line alone on stdout
+    std::vector<long> all;
+    for (auto &r : rtt)
+	all.insert(all.end(), r.begin(), r.end());
+    std::sort(all.begin(), all.end());
+    const long tot = all.size();
+    std::cerr << tot << " jobs by " << engine_name[last[0].engine] << " on ";
+    std::cerr << last[0].workers << " workers, " << retries << " rejected and retried\n";
+    std::cerr << "round trip usec: median " << all[tot / 2] << ", p99 " << all[tot * 99 / 100];
+    std::cerr << ", max " << all.back() << '\n';
+    std::cerr << "per job: " << wait / tot << " usec queued, " << sorting / tot;
+    std::cerr << " usec sorting, " << passes / tot << " passes\n";
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    // the gangs of par meet at a barrier waiting with --wait
+    const bool ok = wait_args(argc, argv);
+    const std::string mode = (argc >= 3) ? argv[1] : "";
+    if (!ok || !((mode == "serve" && argc >= 4) || (mode == "submit" && argc >= 5) || mode == "stop")) {
+	std::cerr << "use: " << argv[0] << " serve socket nworkers [max-jobs] [max-elements]";
+	std::cerr << " [--wait=spin|yield|futex|block]\n";
+	std::cerr << "     " << argv[0] << " submit socket vector-length seed";
+	std::cerr << " [jobs] [clients] [auto|seq|par]\n";
+	std::cerr << "     " << argv[0] << " stop socket\n";
+	return -1;
+    }
+    const std::string path = argv[2];
+
+    if (mode == "serve") {
+	const int nw = std::stol(argv[3]);
+	const int max_jobs = (argc >= 5) ? std::stol(argv[4]) : 64 * nw;
+	const long max_elems = (argc >= 6) ? std::stol(argv[5]) : 1L << 26;
+	return serve(path, nw, max_jobs, max_elems);
+    }
+    if (mode == "stop") {
+	int s = connect_to(path);
+	call(s, {STOP, 0, 0}, -1);
+	close(s);
+	return 0;
+    }
+
+    const long n = std::stol(argv[3]);
+    const int seed = std::stol(argv[4]);
+    const int jobs = (argc >= 6) ? std::stol(argv[5]) : 100;
+    const int clients = (argc >= 7) ? std::stol(argv[6]) : 1;
+    const std::string eng = (argc >= 8) ? argv[7] : "auto";
+    int engine = std::find(engine_name, engine_name + 3, eng) - engine_name;
+    if (engine == 3) {
+	std::cerr << "unknown engine " << eng << '\n';
+	return -1;
+    }
+    // writing a message, a useful log for managing experiments
+    std::string message = argv[0];
+    for (int i = 1; i < argc; ++i)
+	message += ' ' + std::string(argv[i]);
+    return submit(path, n, seed, std::max(1, jobs), std::max(1, clients), engine, message);
+}
@@ -0,0 +1,183 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <memory>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#include "kernels.hpp"
+#include "fill.hpp"
+
+//
+// string keys. The engines do not sort strings but small handles: the
+// first W bytes of the string (W = 8 or 16) loaded big-endian into
+// integers, so that comparing them as unsigned integers is comparing
+// the bytes lexicographically, and a pointer to the whole string.
+// Only when the prefixes are equal the strings are compared, from
+// byte W on, and a transposition moves the handle, never the string.
+// Strings shorter than W are padded with zeros: if the last byte of
+// two equal prefixes is zero the strings ended there, and are equal.
+//
+
+inline uint64_t load_be(const char* s, size_t len) {
+  unsigned char b[8] = {0};
+  std::memcpy(b, s, std::min<size_t>(len, 8));
+  uint64_t x = 0;
+  for (int i = 0; i < 8; ++i)
+    x = x << 8 | b[i];
+  return x;
+}
+
+template<int W> struct str_handle;
+
+template<>
+struct str_handle<8> {
+  uint64_t prefix;
+  const char* s;
+  str_handle(const char* str = "") : s(str) { prefix = load_be(str, std::strlen(str)); }
+  bool operator<(const str_handle& o) const {
+    if (prefix != o.prefix)
+      return prefix < o.prefix;
+    return (prefix & 0xff) && std::strcmp(s + 8, o.s + 8) < 0;
+  }
+  bool operator<=(const str_handle& o) const { return !(o < *this); }
+};
+
+template<>
+struct str_handle<16> {
+  uint64_t hi, lo;
+  const char* s;
+  str_handle(const char* str = "") : s(str) {
+    size_t len = std::strlen(str);
+    hi = load_be(str, len);
+    lo = (len > 8) ? load_be(str + 8, len - 8) : 0;
+  }
+  bool operator<(const str_handle& o) const {
+    if (hi != o.hi)
+      return hi < o.hi;
+    if (lo != o.lo)
+      return lo < o.lo;
+    return (lo & 0xff) && std::strcmp(s + 16, o.s + 16) < 0;
+  }
+  bool operator<=(const str_handle& o) const { return !(o < *this); }
+};
+
+#if defined(__x86_64__) || defined(__i386__)
+// four pairs of 16-byte handles at a time: the pairs are contiguous, so
+// each one fills a 256-bit register as (prefix a, s a, prefix b, s b).
+// The prefixes are deinterleaved and compared as unsigned integers, and
+// only pairs with equal prefixes go through the string compare; a pair
+// is transposed by exchanging the two halves of its register
+__attribute__((target("avx2")))
+inline bool pass_str8_avx2(str_handle<8>* v, long lo, long hi, int parity) {
+  static_assert(sizeof(str_handle<8>) == 16, "handles must be 16 bytes long");
+  const __m256i sign = _mm256_set1_epi64x(INT64_MIN);
+  long j = lo + ((lo ^ parity) & 1);
+  bool swapped = false;
+  for (; j + 8 <= hi; j += 8) {
+    __m256i p[4];
+    for (int k = 0; k < 4; ++k)
+      p[k] = _mm256_loadu_si256((__m256i*) (v + j + 2 * k));
+    __m256i x = _mm256_unpacklo_epi64(p[0], p[1]);  // a0 a1 b0 b1
+    __m256i y = _mm256_unpacklo_epi64(p[2], p[3]);  // a2 a3 b2 b3
+    __m256i a = _mm256_permute2x128_si256(x, y, 0x20);
+    __m256i b = _mm256_permute2x128_si256(x, y, 0x31);
+    int gt = _mm256_movemask_pd(_mm256_castsi256_pd(
+      _mm256_cmpgt_epi64(_mm256_xor_si256(a, sign), _mm256_xor_si256(b, sign))));
+    int eq = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(a, b)));
+    // ties on the prefix: the slow path
+    for (int k = 0; eq; ++k, eq >>= 1)
+      if ((eq & 1) && v[j + 2 * k + 1] < v[j + 2 * k])
+        gt |= 1 << k;
+    for (int k = 0; k < 4; ++k)
+      if (gt >> k & 1)
+        _mm256_storeu_si256((__m256i*) (v + j + 2 * k), _mm256_permute4x64_epi64(p[k], 0x4e));
+    swapped |= gt != 0;
+  }
+  return oe_pass(v, j, hi, parity) || swapped;
+}
+#endif
+
+// handles with 8-byte prefixes use the AVX2 pass if the CPU has it
+inline bool oe_pass(str_handle<8>* v, long lo, long hi, int parity) {
+#if defined(__x86_64__) || defined(__i386__)
+  static const bool has_avx2 = __builtin_cpu_supports("avx2");
+  if (has_avx2)
+    return pass_str8_avx2(v, lo, hi, parity);
+#endif
+  return oe_pass<str_handle<8>>(v, lo, hi, parity);
+}
+
+struct string_config {
+  int prefix = 0;  // 0 sorts integers
+  std::vector<std::unique_ptr<char[]>> arena;
+};
+
+inline string_config& string_cfg() {
+  static string_config cfg;
+  return cfg;
+}
+
+// half log lines sharing a long timestamp prefix, half identifiers
+inline std::string random_string() {
+  char buf[96];
+  if (rand() & 1) {
+    static const char* level[] = {"DEBUG", "INFO", "WARN", "ERROR"};
+    snprintf(buf, sizeof(buf), "2020-06-%02d %02d:%02d:%02d.%03d %s worker-%d: pass %d",
+             1 + rand() % 30, rand() % 24, rand() % 60, rand() % 60, rand() % 1000,
+             level[rand() % 4], rand() % 64, rand());
+    return buf;
+  }
+  static const char* scope[] = {"ff", "oesort", "std", "worker"};
+  std::string id = scope[rand() % 4];
+  for (int i = 0, len = 1 + rand() % 3; i < len; ++i) {
+    id += (i == 0) ? "::" : "_";
+    for (int c = 0, l = 2 + rand() % 8; c < l; ++c)
+      id += 'a' + rand() % 26;
+  }
+  return id;
+}
+
+// handles point to strings kept until exit
+template<int W>
+void fill_random(std::vector<str_handle<W>>& v) {
+  for (auto& z : v) {
+    std::string s = random_string();
+    string_cfg().arena.emplace_back(new char[s.size() + 1]);
+    std::memcpy(string_cfg().arena.back().get(), s.c_str(), s.size() + 1);
+    z = str_handle<W>(string_cfg().arena.back().get());
+  }
+}
+
+// strip --strings=<prefix-bytes> from the command line;
+// returns false on a malformed option
+inline bool string_args(int& argc, char* argv[]) {
+  string_config& cfg = string_cfg();
+  int k = 1;
+  for (int i = 1; i < argc; ++i) {
+    std::string a = argv[i];
+    if (a.rfind("--strings=", 0) == 0) {
+      cfg.prefix = std::stoi(a.substr(10));
+      if (cfg.prefix != 8 && cfg.prefix != 16) {
+        std::cerr << "string prefixes must be 8 or 16 bytes long\n";
+        return false;
+      }
+    }
+    else
+      argv[k++] = argv[i];
+  }
+  argc = k;
+  return true;
+}
+
+// to be appended to the log message of an experiment
+inline std::string string_describe() {
+  if (string_cfg().prefix == 0) return "";
+  return " --strings=" + std::to_string(string_cfg().prefix);
+}
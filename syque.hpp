@@ -7,10 +7,13 @@
 #include <cstddef>
 #include <math.h>
 #include <string>
+#include <atomic>
+#include "wait.hpp"
 
 //
 // needed a blocking queue
 // here is a sample queue
+// (pop waits with the policy given to the constructor, see wait.hpp)
 //
 
 template <typename T>
@@ -18,27 +21,35 @@ class syque
 {
 private:
   std::mutex              d_mutex;
-  std::condition_variable d_condition;
   std::deque<T>           d_queue;
+  std::atomic<size_t>     d_size{0};
+  wait_point              d_waiter;
 public:
 
   syque(std::string s) { std::cout << "Created " << s << " queue " << std::endl;  }
-  syque() {}
+  syque(wait_policy policy = WAIT_BLOCK) : d_waiter(policy) {}
   
   void push(T const& value) {
     {
       std::unique_lock<std::mutex> lock(this->d_mutex);
       d_queue.push_front(value);
+      this->d_size++;
     }
-    this->d_condition.notify_one();
+    this->d_waiter.notify();
   }
   
   T pop() {
-    std::unique_lock<std::mutex> lock(this->d_mutex);
-    this->d_condition.wait(lock, [=]{ return !this->d_queue.empty(); });
-    T rc(std::move(this->d_queue.back()));
-    this->d_queue.pop_back();
-    return rc;
+    while (true) {
+      this->d_waiter.wait([this]{ return this->d_size.load() > 0; });
+      std::unique_lock<std::mutex> lock(this->d_mutex);
+      // another consumer may have been faster
+      if (this->d_queue.empty())
+        continue;
+      T rc(std::move(this->d_queue.back()));
+      this->d_queue.pop_back();
+      this->d_size--;
+      return rc;
+    }
   }
 };
 
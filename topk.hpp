@@ -0,0 +1,137 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <thread>
+#include <cmath>
+#include <algorithm>
+
+//
+// top-k mode. With --top-k=<k> only the k smallest elements are wanted,
+// in order. Before the engine runs they are selected in linear time:
+// the threshold is an order statistic of a regular sample, taken a few
+// standard deviations past rank k so that at least k elements are below
+// it with high probability, and the elements not above it are counted
+// and then compacted by nw threads in parallel, two scans of the vector
+// with no transposition. The few candidates left are cut to exactly k by
+// nth_element, and the engine sorts those alone: no element beyond k is
+// ever moved, so no worker runs on positions past k.
+//
+
+struct topk_config {
+  long k = 0;  // 0 sorts the whole vector
+};
+
+inline topk_config& topk_cfg() {
+  static topk_config cfg;
+  return cfg;
+}
+
+inline bool topk_enabled() { return topk_cfg().k > 0; }
+
+// the length of what the engine sorts out of n elements
+inline long topk_size(long n) { return topk_enabled() ? std::min(topk_cfg().k, n) : n; }
+
+template<typename F>
+void topk_parallel(int nw, size_t n, F f) {
+  std::vector<std::thread> tids;
+  for (int t = 0; t < nw; ++t)
+    tids.emplace_back(f, t, n * t / nw, n * (t + 1) / nw);
+  for (auto& t : tids)
+    t.join();
+}
+
+// the k smallest elements of v, in no particular order
+template<typename V>
+V topk_select(const V& v, size_t k, int nw) {
+  const size_t n = v.size();
+  if (k >= n)
+    return v;
+  const size_t s = std::min<size_t>(n, 4096);
+  std::vector<typename V::value_type> sample;
+  for (size_t i = 0; i < s; ++i)
+    sample.push_back(v[i * n / s]);
+  std::sort(sample.begin(), sample.end());
+  // the rank of the k-th smallest in the sample is binomial
+  const double mean = (double) k * s / n;
+  size_t r = mean + 3 * std::sqrt(mean) + 1;
+  std::vector<size_t> cnt(nw), off(nw);
+  V cand;
+  while (true) {
+    if (r >= s)
+      // the threshold would be past the sample: take everything
+      cand = v;
+    else {
+      const auto& t = sample[r];
+      topk_parallel(nw, n, [&](int tid, size_t lo, size_t hi) {
+        size_t c = 0;
+        for (size_t i = lo; i < hi; ++i)
+          c += !(t < v[i]);
+        cnt[tid] = c;
+      });
+      size_t m = 0;
+      for (int i = 0; i < nw; ++i) {
+        off[i] = m;
+        m += cnt[i];
+      }
+      if (m < k) {
+        // unlucky sample, move the threshold further
+        r = 2 * r + 1;
+        continue;
+      }
+      cand.resize(m);
+      topk_parallel(nw, n, [&](int tid, size_t lo, size_t hi) {
+        size_t o = off[tid];
+        for (size_t i = lo; i < hi; ++i)
+          if (!(t < v[i]))
+            cand[o++] = v[i];
+      });
+    }
+    break;
+  }
+  std::nth_element(cand.begin(), cand.begin() + (k - 1), cand.end());
+  cand.resize(k);
+  return cand;
+}
+
+// top holds the k smallest elements of v in order
+template<typename V, typename W>
+bool topk_check(const V& v, const W& top) {
+  const size_t k = std::min<size_t>(topk_cfg().k, v.size());
+  if (top.size() != k)
+    return false;
+  V ref = v;
+  std::partial_sort(ref.begin(), ref.begin() + k, ref.end());
+  for (size_t i = 0; i < k; ++i)
+    if (ref[i] < top[i] || top[i] < ref[i])
+      return false;
+  return true;
+}
+
+// strip --top-k=<k> from the command line; returns false on a
+// malformed option
+inline bool topk_args(int& argc, char* argv[]) {
+  topk_config& cfg = topk_cfg();
+  int k = 1;
+  for (int i = 1; i < argc; ++i) {
+    std::string a = argv[i];
+    if (a.rfind("--top-k=", 0) == 0) {
+      cfg.k = std::stol(a.substr(8));
+      if (cfg.k <= 0) {
+        std::cerr << "--top-k needs a positive k\n";
+        return false;
+      }
+    }
+    else
+      argv[k++] = argv[i];
+  }
+  argc = k;
+  return true;
+}
+
+// to be appended to the log message of an experiment
+inline std::string topk_describe() {
+  if (!topk_enabled()) return "";
+  return " --top-k=" + std::to_string(topk_cfg().k);
+}
@@ -0,0 +1,291 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <climits>
+#include <ctime>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+//
+// wait strategies. A wait_point is where threads wait for a condition
+// that other threads make true and then signal with notify(). How they
+// wait is a policy, chosen at run time with --wait:
+//   spin   poll with pause, never giving the core away
+//   yield  poll for WAIT_POLLS rounds, then yield between polls
+//   futex  poll for an adaptive number of rounds, then sleep on a futex;
+//          the budget grows while waits end during the spin and shrinks
+//          when they end asleep, as glibc's adaptive mutexes do
+//   block  sleep on a condition variable at once
+// Spinning wins while every thread has a core of its own, sleeping once
+// threads outnumber cores (or share them with SMT siblings), and the gap
+// is an order of magnitude either way. Each blocking point has a default,
+// the one it always had, which --wait overrides. notify() costs a fence
+// and a load unless somebody sleeps. Threads account the time spent in
+// each state, and wait_report() prints the totals on stderr.
+//
+
+enum wait_policy { WAIT_DEFAULT, WAIT_SPIN, WAIT_YIELD, WAIT_FUTEX, WAIT_BLOCK };
+
+const int WAIT_POLLS = 1 << 10;       // polls before yielding
+const int WAIT_POLLS_MIN = 1 << 4;    // bounds of the adaptive budget
+const int WAIT_POLLS_MAX = 1 << 14;
+
+struct wait_config {
+  wait_policy policy = WAIT_DEFAULT;  // the default of each wait point
+};
+
+inline wait_config& wait_cfg() {
+  static wait_config cfg;
+  return cfg;
+}
+
+inline const char* wait_name(wait_policy p) {
+  static const char* names[] = {"default", "spin", "yield", "futex", "block"};
+  return names[p];
+}
+
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#endif
+}
+
+inline void futex_wait(std::atomic<int>* addr, int val, const timespec* timeout = nullptr) {
+  syscall(SYS_futex, (int*) addr, FUTEX_WAIT_PRIVATE, val, timeout, NULL, 0);
+}
+
+inline void futex_wake(std::atomic<int>* addr) {
+  syscall(SYS_futex, (int*) addr, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+// seconds spent in each state by waits that did not find their
+// condition already true
+struct wait_stats {
+  long waits = 0;
+  long sleeps = 0;   // waits that went to sleep
+  double spin = 0, yield = 0, sleep = 0;
+  wait_stats& operator+=(const wait_stats& o) {
+    waits += o.waits;
+    sleeps += o.sleeps;
+    spin += o.spin;
+    yield += o.yield;
+    sleep += o.sleep;
+    return *this;
+  }
+};
+
+// the totals of the threads that have exited or flushed
+struct wait_shared {
+  std::mutex mtx;
+  wait_stats tot;
+};
+
+inline wait_shared& wait_totals() {
+  static wait_shared w;
+  return w;
+}
+
+// per-thread counters, added to the totals when the thread exits
+struct wait_local {
+  wait_stats s;
+  void flush() {
+    wait_shared& w = wait_totals();
+    std::lock_guard<std::mutex> lk(w.mtx);
+    w.tot += s;
+    s = wait_stats();
+  }
+  ~wait_local() { flush(); }
+};
+
+inline wait_local& wait_counters() {
+  thread_local wait_local l;
+  return l;
+}
+
+class wait_point
+{
+private:
+  typedef std::chrono::steady_clock clock;
+  const wait_policy       d_policy;
+  std::atomic<int>        d_seq{0};      // the futex word, bumped by notify
+  std::atomic<int>        d_sleepers{0};
+  std::atomic<int>        d_spin{WAIT_POLLS};
+  std::mutex              d_mutex;
+  std::condition_variable d_condition;
+
+  static double since(clock::time_point& t) {
+    clock::time_point now = clock::now();
+    double s = std::chrono::duration<double>(now - t).count();
+    t = now;
+    return s;
+  }
+
+public:
+
+  wait_point(wait_policy def = WAIT_BLOCK)
+    : d_policy(wait_cfg().policy != WAIT_DEFAULT ? wait_cfg().policy : def) {}
+
+  wait_policy policy() const { return d_policy; }
+
+  // called after making the condition true
+  void notify() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (this->d_sleepers.load(std::memory_order_relaxed) == 0)
+      return;
+    if (this->d_policy == WAIT_BLOCK) {
+      std::lock_guard<std::mutex> lock(this->d_mutex);
+      this->d_condition.notify_all();
+    }
+    else {
+      this->d_seq.fetch_add(1);
+      futex_wake(&this->d_seq);
+    }
+  }
+
+  // wait until ready() holds or the deadline passes, returns ready().
+  // Sleepers are counted before ready() is checked for the last time,
+  // so either notify() sees them or they see the condition
+  template <typename F>
+  bool wait(F const& ready, clock::time_point deadline = clock::time_point::max()) {
+    if (ready())
+      return true;
+    wait_stats& ws = wait_counters().s;
+    ws.waits++;
+    clock::time_point t = clock::now();
+    const bool timed = deadline != clock::time_point::max();
+    if (this->d_policy == WAIT_SPIN) {
+      // no budget: spinning never gives the core away, and only the
+      // deadline of a timed wait returns before ready() holds
+      bool ok;
+      for (unsigned s = 0; !(ok = ready()); ++s) {
+        cpu_relax();
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+        if (timed && (s & (WAIT_POLLS - 1)) == WAIT_POLLS - 1 && clock::now() >= deadline)
+          break;
+      }
+      ws.spin += since(t);
+      return ok;
+    }
+    if (this->d_policy != WAIT_BLOCK) {
+      const int budget = (this->d_policy == WAIT_YIELD) ?
+        WAIT_POLLS : this->d_spin.load(std::memory_order_relaxed);
+      int s = 0;
+      bool ok = false;
+      for (; s < budget; ++s) {
+        if ((ok = ready()))
+          break;
+        cpu_relax();
+        // ready() may read plain variables, they must be read again
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+        if (timed && (s & (WAIT_POLLS - 1)) == WAIT_POLLS - 1 && clock::now() >= deadline)
+          break;
+      }
+      ws.spin += since(t);
+      if (this->d_policy == WAIT_FUTEX) {
+        // aim at twice the polls that were needed, back off after a sleep
+        int b = ok ? (7 * budget + 2 * s) / 8 : budget * 7 / 8;
+        this->d_spin.store(std::max(WAIT_POLLS_MIN, std::min(WAIT_POLLS_MAX, b)),
+                           std::memory_order_relaxed);
+      }
+      if (ok)
+        return ok;
+    }
+    bool ok = false;
+    if (this->d_policy == WAIT_YIELD) {
+      while (!(ok = ready()) && !(timed && clock::now() >= deadline))
+        std::this_thread::yield();
+      ws.yield += since(t);
+      return ok;
+    }
+    ws.sleeps++;
+    if (this->d_policy == WAIT_FUTEX) {
+      this->d_sleepers.fetch_add(1);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      while (true) {
+        int seq = this->d_seq.load();
+        if ((ok = ready()))
+          break;
+        if (!timed)
+          futex_wait(&this->d_seq, seq);
+        else {
+          auto left = deadline - clock::now();
+          if (left <= clock::duration::zero())
+            break;
+          long ns = std::chrono::duration_cast<std::chrono::nanoseconds>(left).count();
+          timespec ts = {ns / 1000000000, ns % 1000000000};
+          futex_wait(&this->d_seq, seq, &ts);
+        }
+      }
+      this->d_sleepers.fetch_sub(1);
+    }
+    else {
+      std::unique_lock<std::mutex> lock(this->d_mutex);
+      this->d_sleepers++;
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (timed)
+        ok = this->d_condition.wait_until(lock, deadline, ready);
+      else {
+        this->d_condition.wait(lock, ready);
+        ok = true;
+      }
+      this->d_sleepers--;
+    }
+    ws.sleep += since(t);
+    return ok;
+  }
+};
+
+// strip --wait=spin|yield|futex|block from the command line; returns
+// false on a malformed option
+inline bool wait_args(int& argc, char* argv[]) {
+  wait_config& cfg = wait_cfg();
+  int k = 1;
+  for (int i = 1; i < argc; ++i) {
+    std::string a = argv[i];
+    if (a.rfind("--wait", 0) == 0) {
+      bool known = false;
+      for (wait_policy p : {WAIT_SPIN, WAIT_YIELD, WAIT_FUTEX, WAIT_BLOCK})
+        if (a == std::string("--wait=") + wait_name(p)) {
+          cfg.policy = p;
+          known = true;
+        }
+      if (!known) {
+        std::cerr << "unknown option " << a << '\n';
+        return false;
+      }
+    }
+    else
+      argv[k++] = argv[i];
+  }
+  argc = k;
+  return true;
+}
+
+// to be appended to the log message of an experiment
+inline std::string wait_describe() {
+  if (wait_cfg().policy == WAIT_DEFAULT) return "";
+  return std::string(" --wait=") + wait_name(wait_cfg().policy);
+}
+
+// the time spent waiting by every thread so far, on stderr, if a
+// policy was chosen
+inline void wait_report() {
+  if (wait_cfg().policy == WAIT_DEFAULT)
+    return;
+  wait_counters().flush();
+  wait_shared& w = wait_totals();
+  std::lock_guard<std::mutex> lk(w.mtx);
+  const wait_stats& tot = w.tot;
+  std::cerr << "wait: " << wait_name(wait_cfg().policy) << ", " << tot.waits << " waits, "
+            << tot.sleeps << " asleep; " << (long) (tot.spin * 1e6) << " usec spinning, "
+            << (long) (tot.yield * 1e6) << " usec yielding, " << (long) (tot.sleep * 1e6)
+            << " usec asleep\n";
+}